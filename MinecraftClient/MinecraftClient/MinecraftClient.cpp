@@ -5,6 +5,7 @@
 #include <boost/thread/thread.hpp>
 #include <boost/function.hpp>
 #include "../../shared/minecraft_shared.hpp"
+#include "../../shared/wire_protocol.hpp"
 #include "message_handler.h"
 #include "chat_client.h"
 
@@ -29,15 +30,17 @@ int main(int argc, char* argv[])
 
 	try
 	{
-		if (argc != 4)
+		if (argc != 4 && argc != 5)
 		{
-			std::cerr << "Usage: MinecraftClient.exe <host> <port> <command>\n";
+			std::cerr << "Usage: MinecraftClient.exe <host> <port> <command> [ascii]\n";
 			getchar();
 			return 1;
 		}
 
 		char* host = argv[1];
 		char* port = argv[2];
+		// servers from before the binary format only understand ascii
+		wire::Format format = (argc == 5 && std::string(argv[4]) == "ascii") ? wire::kAscii : wire::kBinary;
 
 		boost::asio::io_service io_service;
 
@@ -46,7 +49,7 @@ int main(int argc, char* argv[])
 		tcp::resolver::query query(host, port);
 		tcp::resolver::iterator iterator = resolver.resolve(query);
 
-		chat_client c(io_service, iterator);
+		chat_client c(io_service, iterator, format);
 		MessageHandler handler(boost::bind(&chat_client::send_message, &c, _1));
 		c.handler_for_messages_from_server(boost::bind(&MessageHandler::HandleMessage, &handler, _1));
 
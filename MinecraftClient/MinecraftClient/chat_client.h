@@ -10,39 +10,54 @@
 
 #include "stdafx.h"
 #include <cstdlib>
+#include <algorithm>
 #include <deque>
 #include <iostream>
+#include <vector>
 #include <boost/bind.hpp>
 #include <boost/asio.hpp>
 #include <boost/thread/thread.hpp>
 #include <boost/function.hpp>
-#include "../../shared/chat_message.hpp"
+#include <boost/detail/atomic_count.hpp>
+#include "../../shared/wire_protocol.hpp"
 #include "message_handler.h"
 
 using boost::asio::ip::tcp;
 
-typedef std::deque<chat_message> chat_message_queue;
+// frames already encoded in the client's wire format
+typedef std::deque<std::string> chat_frame_queue;
+
+// the most bytes of queued frames written to the server at once
+const size_t kMaxFlushBytes = 64 * 1024;
 
 class chat_client
 {
 public:
+	// The client logs in, and so talks to the server from then on, in the given format.
 	chat_client(boost::asio::io_service& io_service,
-		tcp::resolver::iterator endpoint_iterator)
+		tcp::resolver::iterator endpoint_iterator, wire::Format format = wire::kBinary,
+		size_t max_flush_bytes = kMaxFlushBytes)
 		: io_service_(io_service),
-		socket_(io_service)
+		socket_(io_service),
+		format_(format),
+		max_flush_bytes_(max_flush_bytes),
+		read_buffer_(1024),
+		read_length_(0),
+		flushing_(0),
+		next_request_id_(0)
 	{
 		boost::asio::async_connect(socket_, endpoint_iterator,
 			boost::bind(&chat_client::handle_connect, this,
 			boost::asio::placeholders::error));
 	}
 
-	void handler_for_messages_from_server(boost::function<void(std::string)> handler) {
+	void handler_for_messages_from_server(boost::function<void(const MinecraftMessage&)> handler) {
 		handler_for_messages_from_server_ = handler;
 	}
 
-	void write(const chat_message& msg)
+	void write(const std::string& frame)
 	{
-		io_service_.post(boost::bind(&chat_client::do_write, this, msg));
+		io_service_.post(boost::bind(&chat_client::do_write, this, frame));
 	}
 
 	void close()
@@ -50,13 +65,27 @@ public:
 		io_service_.post(boost::bind(&chat_client::do_close, this));
 	}
 	
-	void send_message(const std::string& message_)  {
-		const char* message = message_.c_str();
-		chat_message msg;
-		msg.body_length(std::strlen(message));
-		std::memcpy(msg.body(), message, msg.body_length());
-		msg.encode_header();
-		this->write(msg);
+	void send_message(const std::string& message)  {
+		std::string frame;
+		wire::encode(MinecraftMessage(message), format_, frame);
+		this->write(frame);
+	}
+
+	// Sends the message tagged with a new request id, and returns the id.  The
+	// reply carries the same id, so the caller needn't wait for it before
+	// sending the next request.
+	unsigned int send_request(const std::string& message)  {
+		MinecraftMessage request(message);
+		// the counter wraps around sooner or later, and 0 means a request has no id
+		unsigned int id;
+		do
+			id = static_cast<unsigned int>(++next_request_id_);
+		while (id == 0);
+		request.set_request_id(id);
+		std::string frame;
+		wire::encode(request, format_, frame);
+		this->write(frame);
+		return request.request_id();
 	}
 private:
 
@@ -64,74 +93,96 @@ private:
 	{
 		if (!error)
 		{
-			boost::asio::async_read(socket_,
-				boost::asio::buffer(read_msg_.data(), chat_message::header_length),
-				boost::bind(&chat_client::handle_read_header, this,
-				boost::asio::placeholders::error));
+			read_more();
 		}
 	}
 
-	void handle_read_header(const boost::system::error_code& error)
+	void read_more()
 	{
-		if (!error && read_msg_.decode_header())
-		{
-			boost::asio::async_read(socket_,
-				boost::asio::buffer(read_msg_.body(), read_msg_.body_length()),
-				boost::bind(&chat_client::handle_read_body, this,
-				boost::asio::placeholders::error));
-		}
-		else
+		if (read_length_ == read_buffer_.size())
+			read_buffer_.resize((std::min)(read_buffer_.size() * 2, wire::kMaxFrameLength));
+		socket_.async_read_some(
+			boost::asio::buffer(&read_buffer_[read_length_], read_buffer_.size() - read_length_),
+			boost::bind(&chat_client::handle_read, this,
+			boost::asio::placeholders::error,
+			boost::asio::placeholders::bytes_transferred));
+	}
+
+	void handle_read(const boost::system::error_code& error, size_t bytes_transferred)
+	{
+		if (error)
 		{
 			do_close();
+			return;
 		}
-	}
+		read_length_ += bytes_transferred;
 
-	void handle_read_body(const boost::system::error_code& error)
-	{
-		if (!error)
+		size_t handled = 0;
+		for (;;)
 		{
+			MinecraftMessage message;
+			wire::Format format;
+			size_t frame_length;
+			wire::ParseResult result = wire::parse(&read_buffer_[0] + handled, read_length_ - handled,
+				message, format, frame_length);
+			if (result == wire::kInvalid)
+			{
+				do_close();
+				return;
+			}
+			if (result == wire::kIncomplete)
+				break;
+			handled += frame_length;
+
 			// handle message from server here
-			auto message = std::string(read_msg_.body(), read_msg_.body_length());
 			handler_for_messages_from_server_(message);
-			
-			boost::asio::async_read(socket_,
-				boost::asio::buffer(read_msg_.data(), chat_message::header_length),
-				boost::bind(&chat_client::handle_read_header, this,
-				boost::asio::placeholders::error));
 		}
-		else
+
+		std::copy(read_buffer_.begin() + handled, read_buffer_.begin() + read_length_, read_buffer_.begin());
+		read_length_ -= handled;
+		// no frame is longer than this, so reading more could never finish it
+		if (read_length_ == wire::kMaxFrameLength)
 		{
 			do_close();
+			return;
 		}
+		read_more();
+	}
+
+	void do_write(const std::string& frame)
+	{
+		write_msgs_.push_back(frame);
+		if (flushing_ == 0)
+			flush();
 	}
 
-	void do_write(chat_message msg)
+	// Writes every queued frame that fits in max_flush_bytes_, and always at
+	// least one, with a single gathered write.
+	void flush()
 	{
-		bool write_in_progress = !write_msgs_.empty();
-		write_msgs_.push_back(msg);
-		if (!write_in_progress)
+		std::vector<boost::asio::const_buffer> buffers;
+		size_t bytes = 0;
+		for (chat_frame_queue::iterator frame = write_msgs_.begin(); frame != write_msgs_.end(); ++frame)
 		{
-			boost::asio::async_write(socket_,
-				boost::asio::buffer(write_msgs_.front().data(),
-				write_msgs_.front().length()),
-				boost::bind(&chat_client::handle_write, this,
-				boost::asio::placeholders::error));
+			if (!buffers.empty() && bytes + frame->length() > max_flush_bytes_)
+				break;
+			buffers.push_back(boost::asio::const_buffer(frame->data(), frame->length()));
+			bytes += frame->length();
 		}
+		flushing_ = buffers.size();
+		boost::asio::async_write(socket_, buffers,
+			boost::bind(&chat_client::handle_write, this,
+			boost::asio::placeholders::error));
 	}
 
 	void handle_write(const boost::system::error_code& error)
 	{
 		if (!error)
 		{
-			write_msgs_.pop_front();
+			write_msgs_.erase(write_msgs_.begin(), write_msgs_.begin() + flushing_);
+			flushing_ = 0;
 			if (!write_msgs_.empty())
-			{
-				boost::asio::async_write(socket_,
-					boost::asio::buffer(write_msgs_.front().data(),
-					write_msgs_.front().length()),
-					boost::bind(&chat_client::handle_write, this,
-					boost::asio::placeholders::error));
-			}
+				flush();
 		}
 		else
 		{
@@ -148,8 +199,14 @@ private:
 private:
 	boost::asio::io_service& io_service_;
 	tcp::socket socket_;
-	chat_message read_msg_;
-	chat_message_queue write_msgs_;
-	boost::function<void(std::string)> handler_for_messages_from_server_;
+	wire::Format format_;
+	size_t max_flush_bytes_;
+	std::vector<char> read_buffer_;
+	size_t read_length_;
+	chat_frame_queue write_msgs_;
+	// how many frames at the front of write_msgs_ the write in progress holds
+	size_t flushing_;
+	// requests may be sent from any thread
+	boost::detail::atomic_count next_request_id_;
+	boost::function<void(const MinecraftMessage&)> handler_for_messages_from_server_;
 };
-
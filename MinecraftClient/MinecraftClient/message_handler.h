@@ -65,6 +65,30 @@ protected:
 		actions_.push_back(UserAction(stream.str(), text, MinecraftMessage(command, message_.user(), params)));
 	}
 
+	// Adds an action for each teleport in a packed teleports list.  Returns how many there were.
+	int AddTeleportActions(const std::string& packed_teleports) {
+		auto teleports = util::tokenize(packed_teleports, minecraft::kDelimiter3);
+		foreach(teleport_string, teleports) {
+			TeleportPair teleport(*teleport_string);
+			std::stringstream text;
+			text << teleport.World << ": " << teleport.Teleport1.Location << " to " << teleport.Teleport2.Location;
+			AddAction(text.str(), commands::teleport, teleport.ToString());
+		}
+		return teleports.size();
+	}
+
+	// Adds an action for each pair in a packed world switches list.  Returns how many there were.
+	int AddWorldSwitchActions(const std::string& packed_worldswitches) {
+		auto worldswitches = util::tokenize(packed_worldswitches, minecraft::kDelimiter3);
+		foreach(worldswitch_string, worldswitches) {
+			WorldSwitch worldswitch(*worldswitch_string);
+			std::stringstream text;
+			text << "Swap between " << worldswitch.World1 << " and " << worldswitch.World2;
+			AddAction(text.str(), commands::worldswitch, worldswitch.ToString());
+		}
+		return worldswitches.size();
+	}
+
 	// Adds the quit option the list of actions, prints all actions, takes input, and returns the command whose shortcut matches the input.
 	UserAction PromptUser() {
 		if(!is_main_menu_)
@@ -113,8 +137,8 @@ public:	UserAction HandleUserInput() {
 		}
 		std::cout << std::endl << user() << ", please enter a command (i.e., type '1' and press enter)." << std::endl;
 
-		AddAction("Teleport Menu", commands::get_teleports, "");
-		AddAction("World Switch Menu", commands::get_worldswitches, "");
+		// one request fetches both lists, so the server only looks at each world once
+		AddAction("Teleport and World Switch Menu", commands::get_menu_state, "");
 //		AddAction("Say", commands::say, "");
 
 		return PromptUser();
@@ -125,15 +149,7 @@ class TeleportsPrompt : public UserActionInterface {
 public:	UserAction HandleUserInput() {
 
 		if(this->message().num_params() > 0) {
-			auto teleports_string = this->message().operator[](0);
-			auto teleports = util::tokenize(teleports_string, minecraft::kDelimiter3);
-
-			foreach(teleport_string, teleports) {
-				TeleportPair teleport(*teleport_string);
-				std::stringstream text;
-				text << teleport.World << ": " << teleport.Teleport1.Location << " to " << teleport.Teleport2.Location;
-				AddAction(text.str(), commands::teleport, teleport.ToString());
-			}
+			AddTeleportActions(this->message().operator[](0));
 			std::cout << std::endl << user() << ", choose the teleport you wish to use." << std::endl;
 		}
 		else {
@@ -146,15 +162,7 @@ public:	UserAction HandleUserInput() {
 class WorldSwitchPrompt : public UserActionInterface {
 public:	UserAction HandleUserInput() {
 		if(this->message().num_params() > 0) {
-			auto worldswitches_string = this->message().operator[](0);
-			auto worldswitches = util::tokenize(worldswitches_string, minecraft::kDelimiter3);
-
-			foreach(worldswitch_string, worldswitches) {
-				WorldSwitch worldswitch(*worldswitch_string);
-				std::stringstream text;
-				text << "Swap between " << worldswitch.World1 << " and " << worldswitch.World2;
-				AddAction(text.str(), commands::worldswitch, worldswitch.ToString());
-			}
+			AddWorldSwitchActions(this->message().operator[](0));
 
 			std::cout << std::endl << user() << ", choose the pair of worlds to swap inventory between." << std::endl;
 		}else {
@@ -165,16 +173,33 @@ public:	UserAction HandleUserInput() {
 	}
 };
 
+// Both lists from get_menu_state in one menu.  An ascii reply drops an empty
+// world switches list off the end, so either parameter may be missing.
+class MenuStatePrompt : public UserActionInterface {
+public:	UserAction HandleUserInput() {
+		int teleports = 0, worldswitches = 0;
+		if(this->message().num_params() > 0)
+			teleports = AddTeleportActions(this->message().operator[](0));
+		if(this->message().num_params() > 1)
+			worldswitches = AddWorldSwitchActions(this->message().operator[](1));
+
+		if(teleports == 0)
+			std::cout << std::endl << user() << ", you are not near any teleports." << std::endl;
+		if(worldswitches == 0)
+			std::cout << std::endl << user() << ", to switch worlds you must be at a teleport location in both worlds." << std::endl;
+		if(teleports + worldswitches > 0)
+			std::cout << std::endl << user() << ", choose a teleport to use or a pair of worlds to swap inventory between." << std::endl;
+
+		return PromptUser();
+	}
+};
+
 class MessageHandler {
 public:
 	MessageHandler(boost::function<void(std::string)> send_to_server_callback) : has_quit_(false) {
 		send_to_server_callback_ = send_to_server_callback;
 	}
-	void HandleMessage(std::string message) {
-		const int buffer_length = 512;
-		char buffer[buffer_length];
-		
-		MinecraftMessage msg(message);
+	void HandleMessage(const MinecraftMessage& msg) {
 		std::string response(commands::quit);
 		
 		response = MapCommandToAction(msg);
@@ -200,6 +225,8 @@ public:
 			return HandleUserAction<MainPrompt>(msg);
 		else if(commands::get_worldswitches_response == cmd)
 			return HandleUserAction<WorldSwitchPrompt>(msg);
+		else if(commands::get_menu_state_response == cmd)
+			return HandleUserAction<MenuStatePrompt>(msg);
 		else if(commands::worldswitch_response == cmd)
 			return HandleUserAction<MainPrompt>(msg);
 		
@@ -11,6 +11,8 @@
 #include <boost/enable_shared_from_this.hpp>
 #include <boost/asio.hpp>
 #include <boost/function.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/filesystem.hpp>
 #include "../../shared/chat_message.hpp"
 #include "variable_bin.h"
 
@@ -18,29 +20,90 @@
 
 #include "minecraft_service.h"
 #include "gcsv.h"
+#include "io_helpers.h"
+#include "nbt.h"
+#include "worldswitch_worker.h"
+#include "work_pool.h"
+#include "teleport_index.h"
+#include "player_cache.h"
+#include "send_buffer.h"
 
 //----------------------------------------------------------------------
 
+// settings are read from the same ini file as WorldSwitch.exe, if it exists:
+//   #io_threads   threads running the network io_service (defaults to one per core)
+//   #work_threads threads handling requests, which block on the disk and on WorldSwitch.exe
+//   #world_threads threads looking at a request's worlds side by side
+//   #flush_bytes  how many bytes of queued messages a session writes to its socket at once
+//   #high_water_bytes a session stops reading requests once this much is waiting to be sent...
+//   #low_water_bytes  ...and starts again once it is down to this much
+//   #max_queued_bytes a session with more than this waiting to be sent is disconnected
+//   #max_jobs     a session stops reading requests while this many of them are being handled
+const std::string kSettingsFile = "worldswitch.ini";
+const int kDefaultWorkThreads = 4;
+const int kDefaultWorldThreads = 8;
+const int kDefaultFlushBytes = 64 * 1024;
+const int kDefaultLowWaterBytes = 64 * 1024;
+const int kDefaultHighWaterBytes = 256 * 1024;
+const int kDefaultMaxQueuedBytes = 1024 * 1024;
+const int kDefaultMaxJobs = 32;
+
+boost::shared_ptr<variable_bin> load_settings() {
+	boost::shared_ptr<variable_bin> settings(new variable_bin());
+	if(boost::filesystem::exists(kSettingsFile))
+		settings->load_from_file(kSettingsFile);
+	return settings;
+}
+
 
 void test_variable_bin();
+void benchmark_variable_bin(int lookups);
 
 void run_tests() {
 	std::cout << "running tests..." << std::endl;
+	io_helpers::test_tokenize();
+	io_helpers::test_line_reader();
+	test_wire_protocol();
+	test_send_buffer();
+	test_slow_consumer();
+	test_handler_job();
+	test_job_limit();
 	gcsv::test_gcsv();
+	nbt::test_nbt();
+	test_teleport_index();
+	test_player_cache();
+	test_worldswitch_worker();
 	test_variable_bin();
 	std::cout << "finished tests..." << std::endl;
 }
 
+void run_benchmarks() {
+	std::cout << "running benchmarks..." << std::endl;
+	benchmark_worldswitch_worker("WorldSwitch.exe", kSettingsFile, 200);
+	benchmark_world_fanout(12, kDefaultWorldThreads, 200);
+	io_helpers::benchmark_tokenize(100000);
+	io_helpers::benchmark_line_reader(1000000);
+	gcsv::benchmark_gcsv(100000, kDefaultWorldThreads);
+	benchmark_write_coalescing(kDefaultFlushBytes, 100000);
+	benchmark_variable_bin(1000000);
+	std::cout << "finished benchmarks..." << std::endl;
+}
+
 
 
 
 #define DEBUG_
+#define BENCHMARK_
 int main(int argc, char* argv[])
 {
 	// uncomment this to run unit tests
 #ifdef DEBUG
 	 run_tests();
 #endif
+	// uncomment this to run benchmarks
+#ifdef BENCHMARK
+	 run_benchmarks();
+#endif
 
 	if(argc < 2) {
 		// These arguments will create one server at the given port
@@ -51,7 +114,16 @@ int main(int argc, char* argv[])
 		argc = 2;
 	}
 
-	boost::shared_ptr<minecraft_service> my_minecraft_service = boost::shared_ptr<minecraft_service>(new minecraft_service());
+	auto settings = load_settings();
+	int io_threads = settings->get_int("io_threads", (std::max)(1, (int)boost::thread::hardware_concurrency()));
+	int work_threads = settings->get_int("work_threads", kDefaultWorkThreads);
+	int world_threads = settings->get_int("world_threads", kDefaultWorldThreads);
+	session_limits limits(settings->get_int("flush_bytes", kDefaultFlushBytes),
+		settings->get_int("low_water_bytes", kDefaultLowWaterBytes),
+		settings->get_int("high_water_bytes", kDefaultHighWaterBytes),
+		settings->get_int("max_queued_bytes", kDefaultMaxQueuedBytes),
+		settings->get_int("max_jobs", kDefaultMaxJobs));
+	boost::shared_ptr<minecraft_service> my_minecraft_service = boost::shared_ptr<minecraft_service>(new minecraft_service(world_threads));
 
 	try
 	{
@@ -62,6 +134,7 @@ int main(int argc, char* argv[])
 		}
 
 		boost::asio::io_service io_service;
+		work_pool blocking_work(work_threads);
 
 		chat_server_list servers;
 		for (int i = 1; i < argc; ++i)
@@ -69,11 +142,15 @@ int main(int argc, char* argv[])
 			int port = std::atoi(argv[i]);
 			std::cout << "listening on port " << port << std::endl;
 			tcp::endpoint endpoint(tcp::v4(), port);
-			chat_server_ptr server(new chat_server(io_service, endpoint, boost::bind(&minecraft_service::handle_message, my_minecraft_service, _1)));
+			chat_server_ptr server(new chat_server(io_service, endpoint, blocking_work, my_minecraft_service, limits));
 			servers.push_back(server);
 		}
 
-		io_service.run();
+		// every session's handlers run through its own strand, so any thread may serve any session
+		boost::thread_group io_thread_group;
+		for (int i = 0; i < io_threads; ++i)
+			io_thread_group.create_thread(boost::bind(&boost::asio::io_service::run, &io_service));
+		io_thread_group.join_all();
 	}
 	catch (std::exception& e)
 	{
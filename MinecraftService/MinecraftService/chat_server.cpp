@@ -15,26 +15,145 @@
 #include <iostream>
 #include <list>
 #include <set>
+#include <vector>
+#include <assert.h>
 #include <boost/bind.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/enable_shared_from_this.hpp>
 #include <boost/asio.hpp>
 #include <boost/function.hpp>
-#include "../../shared/chat_message.hpp"
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/condition_variable.hpp>
 
 #include "chat_server.h"
 
 using boost::asio::ip::tcp;
 
+// how much a session reads at a time, before any frame needs more
+const size_t kReadBufferLength = 1024;
+// how long an evicted client has to read the frames of the write in progress
+const boost::posix_time::time_duration kEvictionLinger = boost::posix_time::seconds(5);
 
-std::string string_from_chars(const char* str, int len) {
-	std::string s(str, len);
-	return s;
+
+handler_job::handler_job(boost::asio::io_service& io_service,
+	const MinecraftMessage& message, boost::posix_time::time_duration timeout)
+	: message_(message),
+	deadline_(boost::posix_time::microsec_clock::universal_time() + timeout),
+	timer_(io_service, deadline_),
+	cancelled_(false),
+	committed_(false),
+	finished_(false)
+{
+}
+
+const MinecraftMessage& handler_job::message() const
+{
+	return message_;
+}
+
+boost::posix_time::ptime handler_job::deadline() const
+{
+	return deadline_;
+}
+
+bool handler_job::cancelled()
+{
+	boost::mutex::scoped_lock lock(mutex_);
+	return cancelled_
+		|| (!committed_ && boost::posix_time::microsec_clock::universal_time() >= deadline_);
+}
+
+void handler_job::cancel()
+{
+	boost::mutex::scoped_lock lock(mutex_);
+	cancelled_ = true;
+}
+
+bool handler_job::commit()
+{
+	boost::mutex::scoped_lock lock(mutex_);
+	if (cancelled_ || boost::posix_time::microsec_clock::universal_time() >= deadline_)
+		return false;
+	committed_ = true;
+	return true;
+}
+
+bool handler_job::expire()
+{
+	boost::mutex::scoped_lock lock(mutex_);
+	if (committed_)
+		return false;
+	cancelled_ = true;
+	return true;
+}
+
+bool handler_job::finish()
+{
+	if (finished_)
+		return false;
+	finished_ = true;
+	return true;
+}
+
+boost::asio::deadline_timer& handler_job::timer()
+{
+	return timer_;
+}
+
+
+send_buffer_ptr encode_frame(const MinecraftMessage& message, wire::Format format)
+{
+	send_buffer_ptr frame = send_buffers().take();
+	wire::encode(message, format, frame->contents());
+	frame->seal();
+	return frame;
+}
+
+outgoing_message::outgoing_message(const MinecraftMessage& message)
+	: message_(message)
+{
+}
+
+const MinecraftMessage& outgoing_message::message() const
+{
+	return message_;
 }
 
+send_buffer_ptr outgoing_message::frame(wire::Format format)
+{
+	boost::mutex::scoped_lock lock(mutex_);
+	send_buffer_ptr& frame = format == wire::kBinary ? binary_frame_ : ascii_frame_;
+	if (!frame)
+		frame = encode_frame(message_, format);
+	return frame;
+}
+
+
+
+session_limits::session_limits(size_t max_flush_bytes, size_t low_water_bytes,
+	size_t high_water_bytes, size_t max_queued_bytes, size_t max_jobs)
+	: max_flush_bytes(max_flush_bytes),
+	low_water_bytes(low_water_bytes),
+	high_water_bytes(high_water_bytes),
+	max_queued_bytes(max_queued_bytes),
+	max_jobs(max_jobs)
+{
+}
+
+
+
+chat_room::chat_room(work_pool& pool, message_handler_ptr handler, const session_limits& limits)
+	: pool_(pool),
+	handler_(handler),
+	limits_(limits),
+	evicted_(0)
+{
+}
 
 void chat_room::join(chat_participant_ptr participant)
 {
+	boost::mutex::scoped_lock lock(mutex_);
 	participants_.insert(participant);
 
 	// when uncommented, the below forwards all messages to the newly connected client
@@ -44,45 +163,107 @@ void chat_room::join(chat_participant_ptr participant)
 
 void chat_room::leave(chat_participant_ptr participant)
 {
+	boost::mutex::scoped_lock lock(mutex_);
 	participants_.erase(participant);
+
+	std::map<chat_participant_ptr, std::string>::iterator name = player_names_.find(participant);
+	if (name != player_names_.end())
+	{
+		players_.erase(name->second);
+		player_names_.erase(name);
+	}
 }
 
-chat_message make_message(const std::string& message_)  {
-	const char* message = message_.c_str();
-	chat_message msg;
-	msg.body_length(std::strlen(message));
-	std::memcpy(msg.body(), message, msg.body_length());
-	msg.encode_header();
-	return msg;
+void chat_room::record_eviction()
+{
+	boost::mutex::scoped_lock lock(mutex_);
+	evicted_++;
+	std::cerr << "evicted a session that stopped reading (" << evicted_ << " so far)" << std::endl;
 }
-void chat_room::deliver(const chat_message& msg)
+
+int chat_room::evicted()
 {
-	recent_msgs_.push_back(msg);
-	std::string message_data = string_from_chars(msg.body(), msg.body_length());
-	std::cout << message_data << std::endl;
-	// This is where I put anything to handle the message
-	std::string forward_message = message_handler_(message_data);
-	bool forward_to_participants = !forward_message.empty();
+	boost::mutex::scoped_lock lock(mutex_);
+	return evicted_;
+}
 
-	while (recent_msgs_.size() > max_recent_msgs)
-		recent_msgs_.pop_front();
+void chat_room::login(const std::string& player, chat_participant_ptr participant)
+{
+	boost::mutex::scoped_lock lock(mutex_);
+	chat_participant_ptr& indexed = players_[player];
+	if (indexed && indexed != participant)
+		player_names_.erase(indexed);
+	indexed = participant;
 
-	chat_message forward = make_message(forward_message);
+	// a session that logs in again under a new name gives up the old one
+	std::string& name = player_names_[participant];
+	if (!name.empty() && name != player)
+		players_.erase(name);
+	name = player;
+}
 
-	if(forward_to_participants)
-		std::for_each(participants_.begin(), participants_.end(),
-			boost::bind(&chat_participant::deliver, _1, boost::ref(forward)));
+bool chat_room::deliver_to(const std::string& player, const MinecraftMessage& msg)
+{
+	chat_participant_ptr participant;
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		std::unordered_map<std::string, chat_participant_ptr>::iterator found = players_.find(player);
+		if (found == players_.end())
+			return false;
+		participant = found->second;
+	}
+	participant->deliver(outgoing_message_ptr(new outgoing_message(msg)));
+	return true;
 }
 
-void chat_room::set_message_handler(message_handler_function handler) {
-	this->message_handler_ = handler;
+void chat_room::deliver(const MinecraftMessage& msg)
+{
+	// one copy for everyone, encoded once per wire format rather than once per participant
+	outgoing_message_ptr shared(new outgoing_message(msg));
+	std::vector<chat_participant_ptr> participants;
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		recent_msgs_.push_back(shared);
+		while (recent_msgs_.size() > max_recent_msgs)
+			recent_msgs_.pop_front();
+		participants.assign(participants_.begin(), participants_.end());
+	}
+
+	// each participant queues the message on its own strand, so this can run unlocked
+	std::for_each(participants.begin(), participants.end(),
+		boost::bind(&chat_participant::deliver, _1, shared));
+}
+
+work_pool& chat_room::pool()
+{
+	return pool_;
+}
+
+message_handler_ptr chat_room::handler()
+{
+	return handler_;
+}
+
+const session_limits& chat_room::limits() const
+{
+	return limits_;
 }
 
 
 
 chat_session::chat_session(boost::asio::io_service& io_service, chat_room& room)
-	: socket_(io_service),
-	room_(room)
+	: io_service_(io_service),
+	socket_(io_service),
+	strand_(io_service),
+	room_(room),
+	read_buffer_(kReadBufferLength),
+	read_length_(0),
+	format_(wire::kAscii),
+	flushing_(0),
+	queued_bytes_(0),
+	reading_paused_(false),
+	evicted_(false),
+	eviction_timer_(io_service)
 {
 }
 
@@ -93,87 +274,281 @@ tcp::socket& chat_session::socket()
 
 void chat_session::start()
 {
-
 	room_.join(shared_from_this());
-	boost::asio::async_read(socket_,
-		boost::asio::buffer(read_msg_.data(), chat_message::header_length),
-		boost::bind(&chat_session::handle_read_header, shared_from_this(),
-			boost::asio::placeholders::error));
+	read_more();
 }
 
-void chat_session::deliver(const chat_message& msg)
+void chat_session::read_more()
 {
-	bool write_in_progress = !write_msgs_.empty();
-	write_msgs_.push_back(msg);
-	if (!write_in_progress)
+	// a frame longer than the buffer makes it grow, up to the longest frame there can be
+	if (read_length_ == read_buffer_.size())
+		read_buffer_.resize((std::min)(read_buffer_.size() * 2, wire::kMaxFrameLength));
+	socket_.async_read_some(
+		boost::asio::buffer(&read_buffer_[read_length_], read_buffer_.size() - read_length_),
+		strand_.wrap(boost::bind(&chat_session::handle_read, shared_from_this(),
+			boost::asio::placeholders::error,
+			boost::asio::placeholders::bytes_transferred)));
+}
+
+// Other sessions deliver to this one from their own strands, so the
+// write queue is only ever touched from inside this session's strand.
+void chat_session::deliver(outgoing_message_ptr msg)
+{
+	strand_.post(boost::bind(&chat_session::do_deliver, shared_from_this(), msg));
+}
+
+void chat_session::do_deliver(outgoing_message_ptr msg)
+{
+	do_write(msg->frame(format_));
+}
+
+void chat_session::do_write(send_buffer_ptr frame)
+{
+	if (evicted_)
+		return;
+	if (queued_bytes_ + frame->size() > room_.limits().max_queued_bytes)
 	{
-		boost::asio::async_write(socket_,
-			boost::asio::buffer(write_msgs_.front().data(),
-			write_msgs_.front().length()),
-			boost::bind(&chat_session::handle_write, shared_from_this(),
-			boost::asio::placeholders::error));
+		evict();
+		return;
 	}
+	write_msgs_.push_back(frame);
+	queued_bytes_ += frame->size();
+	if (flushing_ == 0)
+		flush();
 }
 
-void chat_session::handle_read_header(const boost::system::error_code& error)
+// Frames queued while a write is in progress go out together in the next one,
+// so a burst of messages costs a few writes rather than one each.
+void chat_session::flush()
 {
-	if (!error && read_msg_.decode_header())
+	std::vector<boost::asio::const_buffer> buffers;
+	size_t bytes = 0;
+	for (chat_frame_queue::iterator frame = write_msgs_.begin(); frame != write_msgs_.end(); ++frame)
 	{
-		boost::asio::async_read(socket_,
-			boost::asio::buffer(read_msg_.body(), read_msg_.body_length()),
-			boost::bind(&chat_session::handle_read_body, shared_from_this(),
-			boost::asio::placeholders::error));
+		if (!buffers.empty() && bytes + (*frame)->size() > room_.limits().max_flush_bytes)
+			break;
+		buffers.push_back(*(*frame)->buffer().begin());
+		bytes += (*frame)->size();
 	}
-	else
+	flushing_ = buffers.size();
+	boost::asio::async_write(socket_, buffers,
+		strand_.wrap(boost::bind(&chat_session::handle_write, shared_from_this(),
+		boost::asio::placeholders::error)));
+}
+
+// Handles every whole frame that has arrived, in either wire format, and keeps
+// the start of any frame that is still arriving for the next read.
+void chat_session::handle_read(const boost::system::error_code& error, size_t bytes_transferred)
+{
+	if (error || evicted_)
 	{
-		room_.leave(shared_from_this());
+		leave();
+		return;
 	}
+	read_length_ += bytes_transferred;
+	handle_frames();
 }
 
-void chat_session::handle_read_body(const boost::system::error_code& error)
+void chat_session::handle_frames()
 {
-	if (!error)
+	size_t handled = 0;
+	bool waiting_for_more = false;
+	while (jobs_.size() < room_.limits().max_jobs)
 	{
-		room_.deliver(read_msg_);
-		boost::asio::async_read(socket_,
-			boost::asio::buffer(read_msg_.data(), chat_message::header_length),
-			boost::bind(&chat_session::handle_read_header, shared_from_this(),
-			boost::asio::placeholders::error));
+		MinecraftMessage message;
+		wire::Format format;
+		size_t frame_length;
+		wire::ParseResult result = wire::parse(&read_buffer_[0] + handled, read_length_ - handled,
+			message, format, frame_length);
+		if (result == wire::kInvalid)
+		{
+			leave();
+			return;
+		}
+		if (result == wire::kIncomplete)
+		{
+			waiting_for_more = true;
+			break;
+		}
+		handled += frame_length;
+
+		std::cout << message.AsMessage() << std::endl;
+		// This is where I put anything to handle the message
+		start_job(message, format);
 	}
-	else
+
+	std::copy(read_buffer_.begin() + handled, read_buffer_.begin() + read_length_, read_buffer_.begin());
+	read_length_ -= handled;
+	// no frame is longer than this, so reading more could never finish it
+	if (waiting_for_more && read_length_ == wire::kMaxFrameLength)
 	{
-		room_.leave(shared_from_this());
+		leave();
+		return;
 	}
+	// a client that isn't reading its replies, or that already has as many requests
+	// as it may in flight, doesn't get to send more; frames already read wait here
+	if (queued_bytes_ > room_.limits().high_water_bytes || jobs_.size() >= room_.limits().max_jobs)
+		reading_paused_ = true;
+	else
+		read_more();
+}
+
+void chat_session::resume_reading()
+{
+	if (!reading_paused_ || evicted_ || queued_bytes_ > room_.limits().low_water_bytes
+		|| jobs_.size() >= room_.limits().max_jobs)
+		return;
+	reading_paused_ = false;
+	handle_frames();
 }
 
 void chat_session::handle_write(const boost::system::error_code& error)
 {
+	if (evicted_)
+	{
+		close_evicted(error);
+		return;
+	}
 	if (!error)
 	{
-		write_msgs_.pop_front();
-		if (!write_msgs_.empty())
+		for (size_t i = 0; i < flushing_; i++)
 		{
-			boost::asio::async_write(socket_,
-				boost::asio::buffer(write_msgs_.front().data(),
-				write_msgs_.front().length()),
-				boost::bind(&chat_session::handle_write, shared_from_this(),
-				boost::asio::placeholders::error));
+			queued_bytes_ -= write_msgs_.front()->size();
+			write_msgs_.pop_front();
 		}
+		flushing_ = 0;
+		if (!write_msgs_.empty())
+			flush();
+		resume_reading();
 	}
 	else
 	{
-		room_.leave(shared_from_this());
+		leave();
 	}
 }
 
+// The frames the write in progress holds are kept until it finishes, so the
+// client gets whole frames up to the point it was evicted; everything queued
+// behind them goes now.  A client that never reads them is cut off after
+// kEvictionLinger.
+void chat_session::evict()
+{
+	evicted_ = true;
+	write_msgs_.erase(write_msgs_.begin() + flushing_, write_msgs_.end());
+	queued_bytes_ = 0;
+	leave();
+	room_.record_eviction();
+	if (flushing_ == 0)
+	{
+		close_evicted(boost::system::error_code());
+		return;
+	}
+	eviction_timer_.expires_from_now(kEvictionLinger);
+	eviction_timer_.async_wait(strand_.wrap(
+		boost::bind(&chat_session::close_evicted, shared_from_this(),
+		boost::asio::placeholders::error)));
+}
 
-chat_server::chat_server(boost::asio::io_service& io_service,
-	const tcp::endpoint& endpoint, message_handler_function handler)
+void chat_session::close_evicted(const boost::system::error_code& error)
+{
+	if (error == boost::asio::error::operation_aborted || !socket_.is_open())
+		return;
+	boost::system::error_code ignored;
+	eviction_timer_.cancel(ignored);
+	socket_.shutdown(tcp::socket::shutdown_both, ignored);
+	socket_.close(ignored);
+}
+
+
+// Hands the message to the work pool, so that the network threads never wait
+// on the disk or on WorldSwitch.exe.  The result, or the timeout response if the
+// deadline passes before the job commits, comes back through this session's
+// strand and is written to this session only.
+//
+// A client may have many requests in flight at once.  Each is its own job, and
+// each reply goes out as soon as it is ready, tagged with the request's id, so
+// replies can arrive in a different order from the requests.
+//
+// Logging in also settles the session's wire format: the client is answered in
+// the format it logged in with.
+void chat_session::start_job(const MinecraftMessage& message, wire::Format format)
+{
+	message_handler_ptr handler = room_.handler();
+	std::string player = handler->player_for(message);
+	if (!player.empty())
+	{
+		room_.login(player, shared_from_this());
+		format_ = format;
+	}
+
+	handler_job_ptr job(new handler_job(io_service_, message,
+		handler->timeout_for(message)));
+	jobs_.insert(job);
+
+	job->timer().async_wait(strand_.wrap(
+		boost::bind(&chat_session::expire_job, shared_from_this(), job,
+		boost::asio::placeholders::error)));
+	room_.pool().post(
+		boost::bind(&chat_session::run_job, shared_from_this(), job));
+}
+
+// Runs on the work pool.
+void chat_session::run_job(handler_job_ptr job)
+{
+	MinecraftMessage result;
+	try
+	{
+		result = room_.handler()->handle_message(job->message(), job);
+	}
+	catch (std::exception& e)
+	{
+		std::cerr << "Exception handling " << job->message().AsMessage() << ": " << e.what() << "\n";
+	}
+	result.set_request_id(job->message().request_id());
+	strand_.post(boost::bind(&chat_session::complete_job, shared_from_this(), job, result));
+}
+
+void chat_session::complete_job(handler_job_ptr job, const MinecraftMessage& result)
+{
+	jobs_.erase(job);
+	// a job that ran past its deadline may have stopped part way, so the timer answers instead
+	if (!job->cancelled() && job->finish())
+	{
+		job->timer().cancel();
+		if (!result.empty())
+			do_write(encode_frame(result, format_));
+	}
+	resume_reading();
+}
+
+void chat_session::expire_job(handler_job_ptr job, const boost::system::error_code& error)
+{
+	if (error == boost::asio::error::operation_aborted || !job->expire() || !job->finish())
+		return;
+	MinecraftMessage response = room_.handler()->timeout_response(job->message());
+	response.set_request_id(job->message().request_id());
+	if (!response.empty())
+		do_write(encode_frame(response, format_));
+}
+
+void chat_session::leave()
+{
+	for (std::set<handler_job_ptr>::iterator job = jobs_.begin(); job != jobs_.end(); ++job)
+	{
+		(*job)->cancel();
+		(*job)->timer().cancel();
+	}
+	room_.leave(shared_from_this());
+}
+
+
+chat_server::chat_server(boost::asio::io_service& io_service, const tcp::endpoint& endpoint,
+	work_pool& pool, message_handler_ptr handler, const session_limits& limits)
 	: io_service_(io_service),
-	acceptor_(io_service, endpoint)
+	acceptor_(io_service, endpoint),
+	room_(pool, handler, limits)
 {
 	start_accept();
-	this->room_.set_message_handler(handler);
 }
 
 void chat_server::start_accept()
@@ -195,3 +570,337 @@ void chat_server::handle_accept(chat_session_ptr session,
 	start_accept();
 }
 
+bool chat_server::deliver_to(const std::string& player, const std::string& message)
+{
+	return room_.deliver_to(player, MinecraftMessage(message));
+}
+
+
+void test_wire_protocol()
+{
+	std::cout << "testing wire protocol..." << std::endl;
+	std::deque<std::string> params;
+	params.push_back("w1:spawn:tower|w2:tower:spawn");
+	params.push_back("has,commas");
+	MinecraftMessage reply(commands::get_teleports_response, "PhilipM", params);
+	MinecraftMessage custom("not_a_command", "PhilipM", std::deque<std::string>());
+	const wire::Format formats[] = { wire::kAscii, wire::kBinary };
+
+	std::string stream;
+	wire::encode(reply, wire::kBinary, stream);
+	size_t binary_length = stream.length();
+	wire::encode(custom, wire::kBinary, stream);
+	wire::encode(custom, wire::kAscii, stream);
+
+	// every prefix of a frame is incomplete, and the whole frame parses
+	MinecraftMessage message;
+	wire::Format format;
+	size_t frame_length;
+	for (size_t i = 0; i < binary_length; i++)
+		assert(wire::parse(stream.data(), i, message, format, frame_length) == wire::kIncomplete);
+	assert(wire::parse(stream.data(), stream.length(), message, format, frame_length) == wire::kComplete);
+	assert(format == wire::kBinary && frame_length == binary_length);
+	assert(message.command() == reply.command() && message.user() == reply.user() && message.params() == params);
+
+	size_t offset = frame_length;
+	assert(wire::parse(stream.data() + offset, stream.length() - offset, message, format, frame_length) == wire::kComplete);
+	assert(format == wire::kBinary && message.command() == "not_a_command" && message.num_params() == 0);
+	offset += frame_length;
+	assert(wire::parse(stream.data() + offset, stream.length() - offset, message, format, frame_length) == wire::kComplete);
+	assert(format == wire::kAscii && message.command() == "not_a_command" && message.user() == "PhilipM");
+	assert(offset + frame_length == stream.length());
+
+	std::string ascii;
+	wire::encode(reply, wire::kAscii, ascii);
+	std::cout << "get_teleports_response: " << ascii.length() << " bytes ascii, " << binary_length << " bytes binary" << std::endl;
+
+	// request ids come back in both formats, and an ascii command that only looks tagged is left alone
+	MinecraftMessage tagged(commands::get_teleports, "PhilipM", std::deque<std::string>());
+	tagged.set_request_id(4000000000u);
+	BOOST_FOREACH(wire::Format tagged_format, formats)
+	{
+		std::string frame;
+		wire::encode(tagged, tagged_format, frame);
+		assert(wire::parse(frame.data(), frame.length(), message, format, frame_length) == wire::kComplete);
+		assert(message.command() == commands::get_teleports && message.request_id() == 4000000000u);
+	}
+	std::string untagged = "  17say#hello,PhilipM";
+	assert(wire::parse(untagged.data(), untagged.length(), message, format, frame_length) == wire::kComplete);
+	assert(message.command() == "say#hello" && message.request_id() == 0);
+	std::string zero = "  13say#0,PhilipM";
+	assert(wire::parse(zero.data(), zero.length(), message, format, frame_length) == wire::kComplete);
+	assert(message.command() == "say#0" && message.user() == "PhilipM" && message.request_id() == 0);
+
+	// every command has an id, in the order they are listed
+	unsigned int next_id = 1;
+#define CHECK_COMMAND_ID( x ) assert(wire::command_id(commands::x) == next_id++);
+	MINECRAFT_COMMANDS(CHECK_COMMAND_ID)
+#undef CHECK_COMMAND_ID
+	assert(next_id == wire::kCommandCount && wire::command_id("not_a_command") == 0);
+
+	// an unknown command id can't be read
+	std::string bad;
+	bad.push_back(static_cast<char>(wire::kBinaryMarker));
+	bad.push_back(1);
+	bad.push_back(static_cast<char>(wire::kCommandCount));
+	assert(wire::parse(bad.data(), bad.length(), message, format, frame_length) == wire::kInvalid);
+
+	// nor can a padded varint, or a body length longer than the longest frame allows
+	std::string padded;
+	padded.push_back(static_cast<char>(wire::kBinaryMarker));
+	padded.push_back(static_cast<char>(0x81));
+	padded.push_back(0);
+	assert(wire::parse(padded.data(), padded.length(), message, format, frame_length) == wire::kInvalid);
+	std::string too_long;
+	too_long.push_back(static_cast<char>(wire::kBinaryMarker));
+	too_long.append(3, static_cast<char>(0x80));
+	assert(wire::parse(too_long.data(), too_long.length(), message, format, frame_length) == wire::kInvalid);
+	std::string longest;
+	wire::encode(MinecraftMessage(commands::say, "PhilipM",
+		std::deque<std::string>(1, std::string(wire::kMaxBinaryBody - 16, 'x'))), wire::kBinary, longest);
+	assert(longest.length() <= wire::kMaxFrameLength);
+	assert(wire::parse(longest.data(), longest.length(), message, format, frame_length) == wire::kComplete);
+
+	// a reply too long for one frame keeps the parameters that fit, and its request id
+	std::deque<std::string> large_params;
+	large_params.push_back(std::string(30000, 'a'));
+	large_params.push_back(std::string(30000, 'b'));
+	large_params.push_back(std::string(30000, 'c'));
+	MinecraftMessage oversized(commands::get_teleports_response, "PhilipM", large_params);
+	oversized.set_request_id(7);
+	std::string cut;
+	wire::encode(oversized, wire::kBinary, cut);
+	assert(cut.length() <= wire::kMaxFrameLength);
+	assert(wire::parse(cut.data(), cut.length(), message, format, frame_length) == wire::kComplete);
+	assert(frame_length == cut.length() && message.command() == commands::get_teleports_response);
+	assert(message.num_params() == 2 && message.params()[0] == large_params[0] && message.params()[1] == large_params[1]);
+	assert(message.user() == "PhilipM" && message.request_id() == 7);
+	std::cout << "finished testing wire protocol" << std::endl;
+}
+
+
+void test_handler_job()
+{
+	std::cout << "testing handler jobs..." << std::endl;
+	boost::asio::io_service io_service;
+	MinecraftMessage message(commands::worldswitch, "PhilipM", std::deque<std::string>(1, "w1:w2"));
+
+	handler_job committed(io_service, message, boost::posix_time::milliseconds(20));
+	assert(committed.commit());
+	boost::this_thread::sleep(boost::posix_time::milliseconds(40));
+	assert(!committed.cancelled() && !committed.expire());
+	committed.cancel();
+	assert(committed.cancelled());
+
+	handler_job late(io_service, message, boost::posix_time::milliseconds(0));
+	assert(late.cancelled() && !late.commit());
+	assert(late.expire() && late.finish() && !late.finish());
+	std::cout << "finished testing handler jobs" << std::endl;
+}
+
+
+namespace
+{
+	// Holds every request until released, keeping track of the most held at once.
+	class held_handler : public message_handler
+	{
+	public:
+		held_handler() : held_(0), most_held_(0), released_(false) {}
+
+		MinecraftMessage handle_message(const MinecraftMessage& message, handler_job_ptr job)
+		{
+			boost::mutex::scoped_lock lock(mutex_);
+			most_held_ = (std::max)(most_held_, ++held_);
+			changed_.notify_all();
+			while (!released_)
+				changed_.wait(lock);
+			held_--;
+			return MinecraftMessage(commands::menu_response, message.user(), std::deque<std::string>());
+		}
+		std::string player_for(const MinecraftMessage& message) { return ""; }
+		boost::posix_time::time_duration timeout_for(const MinecraftMessage& message) { return boost::posix_time::seconds(60); }
+		MinecraftMessage timeout_response(const MinecraftMessage& message) { return MinecraftMessage(); }
+
+		// Waits up to a few seconds for count requests to be held at once.
+		bool wait_for(int count)
+		{
+			boost::mutex::scoped_lock lock(mutex_);
+			auto deadline = boost::posix_time::microsec_clock::universal_time() + boost::posix_time::seconds(5);
+			while (held_ < count)
+			{
+				if (!changed_.timed_wait(lock, deadline))
+					return held_ >= count;
+			}
+			return true;
+		}
+		void release()
+		{
+			boost::mutex::scoped_lock lock(mutex_);
+			released_ = true;
+			changed_.notify_all();
+		}
+		int most_held()
+		{
+			boost::mutex::scoped_lock lock(mutex_);
+			return most_held_;
+		}
+
+	private:
+		boost::mutex mutex_;
+		boost::condition_variable changed_;
+		int held_;
+		int most_held_;
+		bool released_;
+	};
+}
+
+void test_job_limit()
+{
+	std::cout << "testing job limit..." << std::endl;
+	const int max_jobs = 4;
+	const int requests = 100;
+	boost::asio::io_service io_service;
+	work_pool pool(max_jobs * 2);
+	boost::shared_ptr<held_handler> handler(new held_handler());
+	chat_room room(pool, handler, session_limits(1024, 64 * 1024, 256 * 1024, 1024 * 1024, max_jobs));
+
+	tcp::acceptor acceptor(io_service, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+	tcp::socket client(io_service);
+	client.connect(acceptor.local_endpoint());
+	chat_session_ptr session(new chat_session(io_service, room));
+	acceptor.accept(session->socket());
+	session->start();
+	boost::thread network(boost::bind(&boost::asio::io_service::run, &io_service));
+
+	// every request arrives in one write, but only max_jobs of them are started
+	std::string pipelined;
+	for (int i = 0; i < requests; i++)
+		wire::encode(MinecraftMessage(commands::menu, "PhilipM", std::deque<std::string>()), wire::kAscii, pipelined);
+	boost::asio::write(client, boost::asio::buffer(pipelined));
+	assert(handler->wait_for(max_jobs));
+	boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+	assert(handler->most_held() == max_jobs);
+
+	// once they are let go the rest follow, and every request is answered
+	handler->release();
+	std::vector<char> received;
+	int answered = 0;
+	while (answered < requests)
+	{
+		char chunk[4096];
+		size_t length = client.read_some(boost::asio::buffer(chunk));
+		received.insert(received.end(), chunk, chunk + length);
+		MinecraftMessage reply;
+		wire::Format format;
+		size_t frame_length;
+		size_t handled = 0;
+		while (wire::parse(&received[0] + handled, received.size() - handled, reply, format, frame_length) == wire::kComplete)
+		{
+			assert(reply.command() == commands::menu_response);
+			handled += frame_length;
+			answered++;
+		}
+		received.erase(received.begin(), received.begin() + handled);
+	}
+	assert(handler->most_held() == max_jobs);
+
+	client.close();
+	io_service.stop();
+	network.join();
+	std::cout << "finished testing job limit" << std::endl;
+}
+
+
+void test_slow_consumer()
+{
+	std::cout << "testing slow consumers..." << std::endl;
+	boost::asio::io_service io_service;
+	work_pool pool(1);
+	chat_room room(pool, message_handler_ptr(), session_limits(1024, 4 * 1024, 16 * 1024, 64 * 1024, 16));
+
+	tcp::acceptor acceptor(io_service, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+	tcp::socket client(io_service);
+	client.connect(acceptor.local_endpoint());
+	chat_session_ptr session(new chat_session(io_service, room));
+	acceptor.accept(session->socket());
+	session->start();
+	boost::thread network(boost::bind(&boost::asio::io_service::run, &io_service));
+
+	// the client never reads, so once the socket buffers fill up its queue only grows
+	std::deque<std::string> params;
+	params.push_back(std::string(400, 'x'));
+	MinecraftMessage message(commands::say, "PhilipM", params);
+	for (int i = 0; i < 200000 && room.evicted() == 0; i++)
+		room.deliver(message);
+	for (int i = 0; i < 500 && room.evicted() == 0; i++)
+		boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+	assert(room.evicted() == 1);
+
+	// the write in progress at the eviction finishes, so the client gets whole
+	// frames, and then the connection ends
+	std::vector<char> received(64 * 1024);
+	size_t total = 0;
+	boost::system::error_code error;
+	while (!error)
+		total += client.read_some(boost::asio::buffer(received), error);
+	assert(error == boost::asio::error::eof);
+	size_t frame_size = encode_frame(message, wire::kAscii)->size();
+	assert(total > 0 && total % frame_size == 0);
+
+	client.close();
+	io_service.stop();
+	network.join();
+	std::cout << "finished testing slow consumers" << std::endl;
+}
+
+
+namespace
+{
+	// Broadcasts count messages to a single session as fast as they can be
+	// queued, and returns how many per second its client received.
+	double TimeDelivery(size_t max_flush_bytes, int count)
+	{
+		using boost::posix_time::microsec_clock;
+		boost::asio::io_service io_service;
+		work_pool pool(1);
+		// the client reads nothing until every message is queued, so there is no limit on the queue
+		size_t unlimited = static_cast<size_t>(-1);
+		chat_room room(pool, message_handler_ptr(), session_limits(max_flush_bytes, unlimited, unlimited, unlimited, unlimited));
+
+		tcp::acceptor acceptor(io_service, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+		tcp::socket client(io_service);
+		client.connect(acceptor.local_endpoint());
+		chat_session_ptr session(new chat_session(io_service, room));
+		acceptor.accept(session->socket());
+		session->start();
+		boost::thread network(boost::bind(&boost::asio::io_service::run, &io_service));
+
+		std::deque<std::string> params;
+		params.push_back("w1:spawn:tower|w2:tower:spawn");
+		MinecraftMessage message(commands::get_teleports_response, "PhilipM", params);
+		size_t expected = encode_frame(message, wire::kAscii)->size() * count;
+
+		auto start = microsec_clock::universal_time();
+		for (int i = 0; i < count; i++)
+			room.deliver(message);
+		std::vector<char> received(64 * 1024);
+		for (size_t total = 0; total < expected; )
+			total += client.read_some(boost::asio::buffer(received));
+		double seconds = (microsec_clock::universal_time() - start).total_microseconds() / 1e6;
+
+		client.close();
+		io_service.stop();
+		network.join();
+		return count / seconds;
+	}
+}
+
+void benchmark_write_coalescing(size_t max_flush_bytes, int count)
+{
+	std::cout << "benchmarking write coalescing..." << std::endl;
+	// a frame always goes out even when it is over the limit, so a limit of one byte writes them one at a time
+	double one_at_a_time = TimeDelivery(1, count);
+	double gathered = TimeDelivery(max_flush_bytes, count);
+	std::cout << count << " messages: " << one_at_a_time << " -> " << gathered
+		<< " messages/sec, flushing up to " << max_flush_bytes << " bytes at a time" << std::endl;
+}
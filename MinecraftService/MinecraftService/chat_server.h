@@ -16,12 +16,20 @@
 #include <iostream>
 #include <list>
 #include <set>
+#include <map>
+#include <vector>
+#include <unordered_map>
 #include <boost/bind.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/enable_shared_from_this.hpp>
 #include <boost/asio.hpp>
 #include <boost/function.hpp>
-#include "../../shared/chat_message.hpp"
+#include <boost/thread/mutex.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include "../../shared/minecraft_shared.hpp"
+#include "../../shared/wire_protocol.hpp"
+#include "send_buffer.h"
+#include "work_pool.h"
 
 
 using boost::asio::ip::tcp;
@@ -29,7 +37,35 @@ using boost::asio::ip::tcp;
 
 //----------------------------------------------------------------------
 
-typedef std::deque<chat_message> chat_message_queue;
+// Encodes the message into a sealed buffer from the shared pool.
+send_buffer_ptr encode_frame(const MinecraftMessage& message, wire::Format format);
+
+// A message on its way to one or more sessions.  It is encoded at most once
+// for each wire format, by the first session that needs it in that format, and
+// every other session writes the same buffer.
+class outgoing_message
+{
+public:
+	outgoing_message(const MinecraftMessage& message);
+
+	const MinecraftMessage& message() const;
+
+	send_buffer_ptr frame(wire::Format format);
+
+private:
+	MinecraftMessage message_;
+	// sessions on different strands may ask for the same frame at once
+	boost::mutex mutex_;
+	send_buffer_ptr ascii_frame_;
+	send_buffer_ptr binary_frame_;
+};
+
+typedef boost::shared_ptr<outgoing_message> outgoing_message_ptr;
+
+typedef std::deque<outgoing_message_ptr> chat_message_queue;
+
+// frames already encoded for one session's wire format
+typedef std::deque<send_buffer_ptr> chat_frame_queue;
 
 //----------------------------------------------------------------------
 
@@ -37,32 +73,143 @@ class chat_participant
 {
 public:
 	virtual ~chat_participant() {}
-	virtual void deliver(const chat_message& msg) = 0;
+	virtual void deliver(outgoing_message_ptr msg) = 0;
 };
 
 typedef boost::shared_ptr<chat_participant> chat_participant_ptr;
 
-typedef boost::function<std::string(std::string)> message_handler_function;
+//----------------------------------------------------------------------
+
+// One message being handled on the work pool.  The handler polls cancelled()
+// between steps, which becomes true once the deadline passes or the session
+// that sent the message goes away.  A committed job ignores its deadline.
+class handler_job
+{
+public:
+	handler_job(boost::asio::io_service& io_service, const MinecraftMessage& message,
+		boost::posix_time::time_duration timeout);
+
+	const MinecraftMessage& message() const;
+
+	boost::posix_time::ptime deadline() const;
+
+	bool cancelled();
+
+	void cancel();
+
+	// Called by the handler just before a step that can't be undone, such as
+	// sending a world switch to WorldSwitch.exe.  Returns false if the job has
+	// already been cancelled.  Otherwise the deadline stops applying: the timer
+	// no longer answers, and the client gets the job's real result whenever it
+	// is ready.
+	bool commit();
+
+	// Called on the session's strand when the deadline timer fires.  Cancels the
+	// job and returns true, unless the job has been committed.
+	bool expire();
+
+	// Called on the session's strand by whichever of the result and the deadline
+	// timer arrives first.  Returns false for the one that arrives second.
+	bool finish();
+
+	boost::asio::deadline_timer& timer();
+
+private:
+	MinecraftMessage message_;
+	boost::posix_time::ptime deadline_;
+	boost::asio::deadline_timer timer_;
+	boost::mutex mutex_;
+	bool cancelled_;
+	bool committed_;
+	bool finished_;
+};
+
+typedef boost::shared_ptr<handler_job> handler_job_ptr;
+
+//----------------------------------------------------------------------
+
+// Handles the messages that arrive from clients, already decoded from whichever
+// wire format they came in.  handle_message runs on the work pool and may block;
+// its non-empty result is sent back to the session the message came from.  If
+// the job's deadline passes first, timeout_response is sent instead.  player_for
+// names the player a message logs in, if any.
+class message_handler
+{
+public:
+	virtual ~message_handler() {}
+	virtual MinecraftMessage handle_message(const MinecraftMessage& message, handler_job_ptr job) = 0;
+	virtual std::string player_for(const MinecraftMessage& message) = 0;
+	virtual boost::posix_time::time_duration timeout_for(const MinecraftMessage& message) = 0;
+	virtual MinecraftMessage timeout_response(const MinecraftMessage& message) = 0;
+};
+
+typedef boost::shared_ptr<message_handler> message_handler_ptr;
+
+//----------------------------------------------------------------------
+
+// How much each session may have waiting to be written to its client.  These
+// bound the memory a client that stops reading can take up.
+struct session_limits
+{
+	session_limits(size_t max_flush_bytes, size_t low_water_bytes,
+		size_t high_water_bytes, size_t max_queued_bytes, size_t max_jobs);
+
+	// the most bytes of queued frames written at once, though always at least one frame
+	size_t max_flush_bytes;
+	// a session stops reading requests once its queue passes high_water_bytes,
+	// and starts again once it drains to low_water_bytes
+	size_t low_water_bytes;
+	size_t high_water_bytes;
+	// a session that would queue more than this is disconnected
+	size_t max_queued_bytes;
+	// a session stops reading requests while this many of its requests are being handled
+	size_t max_jobs;
+};
 
 //----------------------------------------------------------------------
 
 class chat_room
 {
 public:
+	chat_room(work_pool& pool, message_handler_ptr handler, const session_limits& limits);
+
 	void join(chat_participant_ptr participant);
 
 	void leave(chat_participant_ptr participant);
 
-	void deliver(const chat_message& msg);
+	// Counts a participant disconnected for falling too far behind.
+	void record_eviction();
+
+	// how many participants have been evicted
+	int evicted();
+
+	// Sends the message to every participant.
+	void deliver(const MinecraftMessage& msg);
+
+	// Indexes the participant under the player's name, replacing any earlier session.
+	void login(const std::string& player, chat_participant_ptr participant);
 
-	void set_message_handler(message_handler_function handler);
+	// Sends the message to the named player's session.  Returns false if they aren't connected.
+	bool deliver_to(const std::string& player, const MinecraftMessage& msg);
+
+	work_pool& pool();
+
+	message_handler_ptr handler();
+
+	const session_limits& limits() const;
 
 private:
+	// sessions on any io_service thread may join, leave or deliver at once
+	boost::mutex mutex_;
 	std::set<chat_participant_ptr> participants_;
+	std::unordered_map<std::string, chat_participant_ptr> players_;
+	std::map<chat_participant_ptr, std::string> player_names_;
 	enum { max_recent_msgs = 100 };
 	chat_message_queue recent_msgs_;
-	// The message_handler returns true to indicate that we should pass this message on to all clients
-	message_handler_function message_handler_;
+	work_pool& pool_;
+	message_handler_ptr handler_;
+	session_limits limits_;
+	int evicted_;
 };
 
 //----------------------------------------------------------------------
@@ -78,19 +225,70 @@ public:
 
 	void start();
 
-	void deliver(const chat_message& msg);
-
-	void handle_read_header(const boost::system::error_code& error);
+	void deliver(outgoing_message_ptr msg);
 
-	void handle_read_body(const boost::system::error_code& error);
+	void handle_read(const boost::system::error_code& error, size_t bytes_transferred);
 
 	void handle_write(const boost::system::error_code& error);
 
 private:
+	void read_more();
+
+	// Starts a job for each whole frame in the read buffer, while the session
+	// has room for more jobs, then reads more unless it has to pause.
+	void handle_frames();
+
+	// Carries on reading once the client has caught up and a job slot is free.
+	void resume_reading();
+
+	// Writes as many queued frames as fit in one flush with a single gathered write.
+	void flush();
+
+	// Disconnects a client that has stopped reading what it is sent.
+	void evict();
+
+	// Ends the connection of an evicted session once its last write is done,
+	// or once it has had kEvictionLinger to finish.
+	void close_evicted(const boost::system::error_code& error);
+
+	void do_deliver(outgoing_message_ptr msg);
+
+	// Queues a frame already encoded in this session's format.
+	void do_write(send_buffer_ptr frame);
+
+	void start_job(const MinecraftMessage& message, wire::Format format);
+
+	void run_job(handler_job_ptr job);
+
+	void complete_job(handler_job_ptr job, const MinecraftMessage& result);
+
+	void expire_job(handler_job_ptr job, const boost::system::error_code& error);
+
+	void leave();
+
+	boost::asio::io_service& io_service_;
 	tcp::socket socket_;
+	// every handler that touches this session's state runs through the strand
+	boost::asio::io_service::strand strand_;
 	chat_room& room_;
-	chat_message read_msg_;
-	chat_message_queue write_msgs_;
+	// bytes read but not yet handled; a frame may arrive over several reads
+	std::vector<char> read_buffer_;
+	size_t read_length_;
+	// replies go out in the format the client logged in with
+	wire::Format format_;
+	chat_frame_queue write_msgs_;
+	// how many frames at the front of write_msgs_ the write in progress holds
+	size_t flushing_;
+	// the bytes in write_msgs_
+	size_t queued_bytes_;
+	// no read is outstanding while the client is behind on what it has been sent,
+	// or while it has max_jobs requests being handled
+	bool reading_paused_;
+	bool evicted_;
+	// bounds how long an evicted session's last write may take
+	boost::asio::deadline_timer eviction_timer_;
+	// jobs still running on the work pool, so they can be cancelled if the session goes away
+	std::set<handler_job_ptr> jobs_;
 };
 
 typedef boost::shared_ptr<chat_session> chat_session_ptr;
@@ -100,14 +298,17 @@ typedef boost::shared_ptr<chat_session> chat_session_ptr;
 class chat_server
 {
 public:
-	chat_server(boost::asio::io_service& io_service,
-		const tcp::endpoint& endpoint, message_handler_function handler);
+	chat_server(boost::asio::io_service& io_service, const tcp::endpoint& endpoint,
+		work_pool& pool, message_handler_ptr handler, const session_limits& limits);
 
 	void start_accept();
 
 	void handle_accept(chat_session_ptr session,
 		const boost::system::error_code& error);
 
+	// Pushes a message to one logged in player.  Returns false if they aren't connected.
+	bool deliver_to(const std::string& player, const std::string& message);
+
 private:
 	boost::asio::io_service& io_service_;
 	tcp::acceptor acceptor_;
@@ -116,3 +317,20 @@ private:
 
 typedef boost::shared_ptr<chat_server> chat_server_ptr;
 typedef std::list<chat_server_ptr> chat_server_list;
+
+
+// Round trips messages through both wire formats.
+void test_wire_protocol();
+
+// Checks that a client that stops reading is disconnected.
+void test_slow_consumer();
+
+// Checks that a committed job outlives its deadline and one past it can't commit.
+void test_handler_job();
+
+// Checks that a client pipelining many requests has at most max_jobs handled at once.
+void test_job_limit();
+
+// Times count messages broadcast to one session over loopback, written a frame
+// at a time and then gathered up to max_flush_bytes at a time.
+void benchmark_write_coalescing(size_t max_flush_bytes, int count);
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "stdafx.h"
+#include <ctime>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <boost/cstdint.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/function.hpp>
+#include <boost/thread/mutex.hpp>
+
+// FileCache keeps the parsed form of files, keyed by path.  Each get() checks the
+// file's modification time and size, and only calls the loader again when one of
+// them has changed, so a steady-state request does no parsing at all.
+// A file that doesn't exist is cached too, until it appears.
+template <typename T>
+class FileCache {
+public:
+	typedef std::shared_ptr<T> ValuePtr;
+	typedef boost::function<ValuePtr(const std::string&)> Loader;
+
+	FileCache(std::string name) : name_(name), entries_(), hits_(0), misses_(0) {}
+
+	ValuePtr get(const std::string& path, Loader load) {
+		Stamp stamp = StampOf(path);
+		{
+			boost::mutex::scoped_lock lock(mutex_);
+			auto entry = entries_.find(path);
+			if(entry != entries_.end() && entry->second.stamp == stamp) {
+				hits_++;
+				return entry->second.value;
+			}
+			misses_++;
+		}
+
+		// two threads may both load a file that just changed; the last one to finish is kept
+		ValuePtr value = load(path);
+		boost::mutex::scoped_lock lock(mutex_);
+		Entry& entry = entries_[path];
+		entry.stamp = stamp;
+		entry.value = value;
+		std::cout << "loaded " << path << " into " << name_ << " cache (hits: " << hits_ << ", misses: " << misses_ << ")" << std::endl;
+		return value;
+	}
+
+	int hits() {
+		boost::mutex::scoped_lock lock(mutex_);
+		return hits_;
+	}
+
+	int misses() {
+		boost::mutex::scoped_lock lock(mutex_);
+		return misses_;
+	}
+
+private:
+	struct Stamp {
+		std::time_t modified;
+		boost::uintmax_t size;
+		bool exists;
+		bool operator==(const Stamp& other) const {
+			return exists == other.exists && modified == other.modified && size == other.size;
+		}
+	};
+
+	struct Entry {
+		Stamp stamp;
+		ValuePtr value;
+	};
+
+	static Stamp StampOf(const std::string& path) {
+		boost::system::error_code error;
+		Stamp stamp;
+		stamp.modified = boost::filesystem::last_write_time(path, error);
+		stamp.exists = !error;
+		stamp.size = stamp.exists ? boost::filesystem::file_size(path, error) : 0;
+		if(!stamp.exists)
+			stamp.modified = 0;
+		return stamp;
+	}
+
+	std::string name_;
+	boost::mutex mutex_;
+	std::map<std::string, Entry> entries_;
+	int hits_;
+	int misses_;
+};
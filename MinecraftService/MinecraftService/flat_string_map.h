@@ -0,0 +1,117 @@
+#pragma once
+
+#include "stdafx.h"
+#include <string>
+#include <utility>
+#include <vector>
+#include "../../shared/string_view.hpp"
+
+// An open-addressed hash map from strings to V, for small tables that are read
+// far more often than they are written.  Lookups take a util::string_view, so
+// finding a key never allocates.  Keys are never removed.
+//
+// The slots are a power of two, at most half of them used, and a key that
+// collides takes the next free slot after its own.
+template <typename V>
+class flat_string_map
+{
+public:
+	flat_string_map() : slots_(8), size_(0) {}
+
+	const V* find(util::string_view key) const
+	{
+		const slot& found = slots_[position(key, hash(key))];
+		return found.used ? &found.value : NULL;
+	}
+
+	V* find(util::string_view key)
+	{
+		slot& found = slots_[position(key, hash(key))];
+		return found.used ? &found.value : NULL;
+	}
+
+	// Adds the key with the value, unless the key is already there.  Returns the
+	// value the map holds for the key, and whether it was added.
+	std::pair<V*, bool> insert(util::string_view key, const V& value)
+	{
+		size_t key_hash = hash(key);
+		size_t place = position(key, key_hash);
+		if (slots_[place].used)
+			return std::make_pair(&slots_[place].value, false);
+		if (2 * (size_ + 1) > slots_.size())
+		{
+			grow();
+			place = position(key, key_hash);
+		}
+		slot& added = slots_[place];
+		added.used = true;
+		added.hash = key_hash;
+		added.key = key.str();
+		added.value = value;
+		size_++;
+		return std::make_pair(&added.value, true);
+	}
+
+	// the value for the key, added as V() if the key isn't there yet
+	V& operator[](util::string_view key)
+	{
+		return *insert(key, V()).first;
+	}
+
+	size_t size() const
+	{
+		return size_;
+	}
+
+private:
+	struct slot
+	{
+		slot() : used(false), hash(0), key(), value() {}
+		bool used;
+		size_t hash;
+		std::string key;
+		V value;
+	};
+
+	// FNV-1a
+	static size_t hash(util::string_view key)
+	{
+		unsigned long long hash = 14695981039346656037ULL;
+		for (size_t i = 0; i < key.size(); i++)
+		{
+			hash ^= static_cast<unsigned char>(key[i]);
+			hash *= 1099511628211ULL;
+		}
+		return static_cast<size_t>(hash);
+	}
+
+	// the slot holding the key, or the free slot where it would go
+	size_t position(util::string_view key, size_t key_hash) const
+	{
+		size_t mask = slots_.size() - 1;
+		size_t place = key_hash & mask;
+		while (slots_[place].used
+			&& (slots_[place].hash != key_hash || util::string_view(slots_[place].key) != key))
+			place = (place + 1) & mask;
+		return place;
+	}
+
+	void grow()
+	{
+		std::vector<slot> old(slots_.size() * 2);
+		old.swap(slots_);
+		for (size_t i = 0; i < old.size(); i++)
+		{
+			if (!old[i].used)
+				continue;
+			slot& moved = slots_[position(old[i].key, old[i].hash)];
+			moved.used = true;
+			moved.hash = old[i].hash;
+			moved.key.swap(old[i].key);
+			moved.value = old[i].value;
+		}
+	}
+
+	std::vector<slot> slots_;
+	size_t size_;
+};
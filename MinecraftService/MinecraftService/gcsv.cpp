@@ -1,91 +1,501 @@
-
 #include "stdafx.h"
 #include <algorithm>
 #include <cstdlib>
-#include <array>
-#include <boost/bind.hpp>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <boost/filesystem.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
 
 #include "gcsv.h"
 
 #include "io_helpers.h"
+#include "work_pool.h"
 
-class GcsvReader {
+// Turns the lines of a gcsv file into calls on a GcsvVisitor.
+class GcsvScanner {
 public:
-	GcsvReader() : has_table_(false), collection_(new GcsvTableCollection()), name_("") {
+	GcsvScanner(GcsvVisitor& visitor)
+		: visitor_(visitor), started_(false), awaiting_header_(false), in_rows_(false), skipping_(false), stopped_(false) {
 	}
 
-	void HandleLine(std::string line) {
+	// Returns false once the visitor has asked to stop.  The line is never empty.
+	bool HandleLine(util::string_view line) {
 		// here's where we handle each input line when reading a gcsv file !!
 
-		auto tokens = io_helpers::tokenize(line, ',');
-
 		// If this is the start of a gcsv
-		if(tokens[0][0] == gcsv::kGcsvInitialCharacter) {
+		if(line[0] == gcsv::kGcsvInitialCharacter) {
+			// the fields point into the source, and fields_ keeps its storage from one line to the next
+			util::split(line, ',', fields_);
 			// If we had already started a gcsv, this must be the next one,
-			// so we return the one we were filling up.
-			if(has_table_) {
-				collection_->AddTable(table_);
-			}
-			name_ = tokens.at(0).substr(1, tokens[0].length() - 1);
+			// so we end the one we were reading.
+			if(!EndTable())
+				return false;
+			name_ = fields_[0].substr(1).str();
 
 			// If the gcsv header is defined on the same line as the name
 			// the line will have multiple delimited values and the second
 			// value, which is the first field name in the header, will
 			// not be empty.
-			if(tokens.size() > 1 && tokens[1].length() > 0)
-			{
-				tokens.erase(tokens.begin());
-				StartGcsv(tokens);
+			bool has_header = fields_.size() > 1 && fields_[1].length() > 0;
+			if(has_header || !name_.empty()) {
+				if(!StartTable())
+					return false;
+				if(has_header)
+					return StartRows(1);
+				awaiting_header_ = true;
 			}
 		}
-		// If we've already started a gcsv, we can add this line to it.
-		else if(has_table_) {
-			auto header = table_->header();
-			if(tokens.size() < header->size()) {
-				for(int k = tokens.size(); k < header->size(); k++) {
-					tokens.push_back("");
-				}
-			}
-			table_->Add(std::shared_ptr<GcsvLine>(new GcsvLine(header, tokens)));
+		// If we've already started a gcsv, this line is one of its rows.
+		else if(in_rows_) {
+			if(skipping_)
+				return true;
+			if(!visitor_.SplitsRows())
+				return Handle(visitor_.RowLine(line));
+			util::split(line, ',', fields_);
+			return Handle(visitor_.Row(fields_));
 		}
-		else {
-			// If we've read the name of the gcsv, but not the header
-			// then this line is the header.
-			if(name_.empty()) {
-				StartGcsv(tokens);
-			}
+		// If we've read the name of the gcsv, but not the header
+		// then this line is the header.
+		else if(awaiting_header_) {
+			util::split(line, ',', fields_);
+			return StartRows(0);
 		}
+		return true;
+	}
+
+	// Called when the file is all read.  This ends the last gcsv.
+	void Finish() {
+		EndTable();
+	}
+
+private:
+	bool StartTable() {
+		started_ = true;
+		skipping_ = false;
+		return Handle(visitor_.StartTable(name_));
 	}
 
-	// Called when a new Gcsv header has been read.  
-	// Creates a new GcsvTable with the given header and the current name.
-	void StartGcsv(const vector_str& tokens) {
+	// Called when a Gcsv header has been read, starting at field first.
+	bool StartRows(size_t first) {
+		awaiting_header_ = false;
+		in_rows_ = true;
+		if(skipping_)
+			return true;
 		vector_str header_tokens;
-		for(auto it = tokens.begin(); it < tokens.end(); it++) {
-			if(!(*it).empty())
-				header_tokens.push_back(*it);
+		for(size_t field = first; field < fields_.size(); field++) {
+			if(!fields_[field].empty())
+				header_tokens.push_back(fields_[field].str());
 		}
-		auto header = std::shared_ptr<GcsvHeader>(new GcsvHeader(name_, header_tokens));
-		table_ = std::shared_ptr<GcsvTable>(new GcsvTable(header));
-		has_table_ = true;
+		return Handle(visitor_.Header(GcsvHeaderPtr(new GcsvHeader(name_, header_tokens))));
 	}
 
-	// Called when the file is all read.
-	// This closes the last gcsv and adds it to the table.
-	void Finish() {
-		if(has_table_) {
+	bool EndTable() {
+		awaiting_header_ = false;
+		in_rows_ = false;
+		if(!started_ || stopped_)
+			return !stopped_;
+		started_ = false;
+		return Handle(visitor_.EndTable());
+	}
+
+	bool Handle(gcsv::VisitResult result) {
+		if(result == gcsv::kSkipTable)
+			skipping_ = true;
+		else if(result == gcsv::kStop)
+			stopped_ = true;
+		return !stopped_;
+	}
+
+	GcsvVisitor& visitor_;
+	std::string name_;
+	std::vector<util::string_view> fields_;
+	// StartTable has been called and EndTable hasn't
+	bool started_;
+	// the table's name has been read, and its header is on the next line
+	bool awaiting_header_;
+	// the header has been read, so lines are rows
+	bool in_rows_;
+	bool skipping_;
+	bool stopped_;
+};
+
+
+// Builds a GcsvTableCollection out of every table it visits.
+class GcsvReader : public GcsvVisitor {
+public:
+	GcsvReader(GcsvSourcePtr source, gcsv::FieldMode fields)
+		: source_(source), fields_(fields), collection_(new GcsvTableCollection()) {
+	}
+
+	// Creates a new GcsvTable with the given header.
+	gcsv::VisitResult Header(GcsvHeaderPtr header) {
+		table_ = GcsvTablePtr(new GcsvTable(header, source_, fields_));
+		return gcsv::kContinue;
+	}
+
+	// The table fills in any fields the line is missing.
+	gcsv::VisitResult Row(const std::vector<util::string_view>& fields) {
+		table_->Add(fields);
+		return gcsv::kContinue;
+	}
+
+	// A lazy table splits its lines itself.
+	bool SplitsRows() const {
+		return fields_ == gcsv::kEagerFields;
+	}
+	gcsv::VisitResult RowLine(util::string_view line) {
+		table_->AddLine(line);
+		return gcsv::kContinue;
+	}
+
+	// Indexes the gcsv being filled, if any, and adds it to the collection.
+	gcsv::VisitResult EndTable() {
+		if(table_) {
+			table_->Finish();
 			collection_->AddTable(table_);
-			has_table_ = false;
+			last_table_ = table_;
+			table_.reset();
 		}
+		return gcsv::kContinue;
 	}
 
 	std::shared_ptr<GcsvTableCollection> GetTableCollection() { return collection_; }
-	
+	// the last table read, if any
+	GcsvTablePtr GetLastTable() { return last_table_; }
+
 private:
+	GcsvSourcePtr source_;
+	gcsv::FieldMode fields_;
 	std::shared_ptr<GcsvTableCollection> collection_;
 	std::shared_ptr<GcsvTable> table_;
-	bool has_table_;
-	std::string name_;
+	std::shared_ptr<GcsvTable> last_table_;
+};
+
+
+namespace {
+
+	// Hands the scanner the trimmed, valid lines from begin to end.  Returns false
+	// if the visitor stopped it.
+	bool ScanLines(const char* begin, const char* end, GcsvScanner& scanner) {
+		return io_helpers::for_each_line(begin, end, [&scanner](util::string_view line) {
+			return scanner.HandleLine(line);
+		});
+	}
+
+	// Where each table starts: every line whose first character, past any spaces
+	// and tabs, is kGcsvInitialCharacter.  Only the markers are looked at, so this
+	// is much quicker than going through the lines.
+	std::vector<const char*> FindTableStarts(const char* begin, const char* end) {
+		std::vector<const char*> starts;
+		const char* next = begin;
+		while(const char* marker = static_cast<const char*>(std::memchr(next, gcsv::kGcsvInitialCharacter, end - next))) {
+			const char* line = marker;
+			while(line != begin && (line[-1] == ' ' || line[-1] == '\t'))
+				--line;
+			if(line == begin || line[-1] == '\n')
+				starts.push_back(line);
+			next = marker + 1;
+		}
+		return starts;
+	}
+
+	// what test_gcsv decodes rows into
+	struct BoundPlace {
+		struct Position {
+			double depth;
+		};
+		std::string name;
+		double height;
+		Position where;
+		std::string note;
+	};
+
+	// Writes down what test_gcsv's visits see, skipping one table and stopping at one key.
+	class RecordingVisitor : public GcsvVisitor {
+	public:
+		RecordingVisitor(std::string skip, std::string stop_at) : skip_(skip), stop_at_(stop_at) {}
+		gcsv::VisitResult StartTable(util::string_view name) {
+			seen += "<" + name.str();
+			return name == skip_ ? gcsv::kSkipTable : gcsv::kContinue;
+		}
+		gcsv::VisitResult Header(GcsvHeaderPtr header) {
+			seen += ":" + header->GetFirstColumnName();
+			return gcsv::kContinue;
+		}
+		gcsv::VisitResult Row(const std::vector<util::string_view>& fields) {
+			seen += " " + fields[0].str();
+			return fields[0] == stop_at_ ? gcsv::kStop : gcsv::kContinue;
+		}
+		gcsv::VisitResult EndTable() {
+			seen += ">";
+			return gcsv::kContinue;
+		}
+		std::string seen;
+	private:
+		std::string skip_;
+		std::string stop_at_;
+	};
+
+	// FNV-1a, to tell whether a sidecar was compiled from the file as it is now
+	unsigned long long HashBytes(const char* data, size_t size) {
+		unsigned long long hash = 14695981039346656037ULL;
+		for(size_t i = 0; i < size; i++) {
+			hash ^= static_cast<unsigned char>(data[i]);
+			hash *= 1099511628211ULL;
+		}
+		return hash;
+	}
+
+	// Identifies the text a sidecar was compiled from.
+	struct SidecarStamp {
+		SidecarStamp(const std::string& path, const GcsvSource& text)
+			: time(static_cast<unsigned long long>(boost::filesystem::last_write_time(path))),
+			size(text.size()),
+			hash(HashBytes(text.data(), text.size())) {
+		}
+		bool operator==(const SidecarStamp& other) const {
+			return time == other.time && size == other.size && hash == other.hash;
+		}
+		unsigned long long time;
+		unsigned long long size;
+		unsigned long long hash;
+	};
+
+	const char kSidecarMagic[8] = { 'G', 'C', 'S', 'V', 'B', 0, 0, 2 };
+
+	// Appends the fixed size fields of a sidecar.
+	class SidecarWriter {
+	public:
+		SidecarWriter(std::string& out) : out_(out) {}
+		void put(const void* data, size_t size) {
+			out_.append(static_cast<const char*>(data), size);
+		}
+		void put_u32(unsigned int value) {
+			put(&value, sizeof(value));
+		}
+		void put_u64(unsigned long long value) {
+			put(&value, sizeof(value));
+		}
+		void put_string(const std::string& text) {
+			put_u32(static_cast<unsigned int>(text.size()));
+			put(text.data(), text.size());
+			out_.append(Padding(text.size()), '\0');
+		}
+		static size_t Padding(size_t size) {
+			return (4 - size % 4) % 4;
+		}
+		static size_t StringSize(const std::string& text) {
+			return 4 + text.size() + Padding(text.size());
+		}
+	private:
+		std::string& out_;
+	};
+
+	// Walks the fields of a mapped sidecar, refusing to go past its end.
+	class SidecarReader {
+	public:
+		SidecarReader(const char* data, size_t size) : next_(data), end_(data + size) {}
+		const char* take(size_t size) {
+			if(static_cast<size_t>(end_ - next_) < size)
+				return NULL;
+			const char* taken = next_;
+			next_ += size;
+			return taken;
+		}
+		// count elements of the given size, checked before multiplying so that a
+		// damaged count can't wrap around to something small
+		const char* take(size_t count, size_t size) {
+			if(count > static_cast<size_t>(end_ - next_) / size)
+				return NULL;
+			return take(count * size);
+		}
+		bool get_u32(unsigned int& value) {
+			const char* taken = take(sizeof(value));
+			if(taken)
+				std::memcpy(&value, taken, sizeof(value));
+			return taken != NULL;
+		}
+		bool get_u64(unsigned long long& value) {
+			const char* taken = take(sizeof(value));
+			if(taken)
+				std::memcpy(&value, taken, sizeof(value));
+			return taken != NULL;
+		}
+		bool get_string(std::string& text) {
+			unsigned int size;
+			if(!get_u32(size))
+				return false;
+			const char* taken = take(size);
+			if(!taken || !take(SidecarWriter::Padding(size)))
+				return false;
+			text.assign(taken, size);
+			return true;
+		}
+	private:
+		const char* next_;
+		const char* end_;
+	};
+}
+
+
+// A .gcsvb sidecar holds a gcsv file already indexed, so that it can be mapped
+// and used as it is.  Everything is in the machine's own byte order:
+//   kSidecarMagic, whose last byte is the version
+//   u64 time, size and hash of the text it was compiled from
+//   u32 table count, u32 where the string table starts
+//   for each table:
+//     string name, u32 column count, string for each column name, u32 line count
+//     for each column, a GcsvCell per line, counted from the start of the sidecar
+//     the key index: u32 slot count, the slots, then the next line for each line
+//   the string table, which is the text itself
+// A string is a u32 length, then the bytes, padded to a multiple of four.
+class GcsvSidecar {
+public:
+	// The tables in the sidecar, or an empty pointer if it is missing, damaged,
+	// or was compiled from something other than the text as it is now.
+	static GcsvTableCollectionPtr Load(const std::string& path, const SidecarStamp& stamp) {
+		GcsvSourcePtr file;
+		try {
+			if(!boost::filesystem::exists(path))
+				return GcsvTableCollectionPtr();
+			file = GcsvSource::map(path);
+		}
+		catch(std::exception&) {
+			return GcsvTableCollectionPtr();
+		}
+
+		SidecarReader in(file->data(), file->size());
+		const char* magic = in.take(sizeof(kSidecarMagic));
+		unsigned long long time, size, hash;
+		unsigned int table_count, strings_start;
+		if(!magic || std::memcmp(magic, kSidecarMagic, sizeof(kSidecarMagic)) != 0
+			|| !in.get_u64(time) || !in.get_u64(size) || !in.get_u64(hash)
+			|| time != stamp.time || size != stamp.size || hash != stamp.hash
+			|| !in.get_u32(table_count) || !in.get_u32(strings_start))
+			return GcsvTableCollectionPtr();
+
+		GcsvTableCollectionPtr tables(new GcsvTableCollection());
+		tables->compiled_ = true;
+		for(unsigned int table = 0; table < table_count; table++) {
+			std::string name;
+			unsigned int column_count, rows;
+			if(!in.get_string(name) || !in.get_u32(column_count) || column_count == 0)
+				return GcsvTableCollectionPtr();
+			vector_str columns(column_count);
+			for(unsigned int column = 0; column < column_count; column++) {
+				if(!in.get_string(columns[column]))
+					return GcsvTableCollectionPtr();
+			}
+			if(!in.get_u32(rows))
+				return GcsvTableCollectionPtr();
+
+			std::vector<const GcsvCell*> cells(column_count);
+			for(unsigned int column = 0; column < column_count; column++) {
+				cells[column] = reinterpret_cast<const GcsvCell*>(in.take(rows, sizeof(GcsvCell)));
+				if(!cells[column])
+					return GcsvTableCollectionPtr();
+				for(unsigned int row = 0; row < rows; row++) {
+					const GcsvCell& cell = cells[column][row];
+					if(cell.offset < strings_start || cell.offset > file->size() || cell.length > file->size() - cell.offset)
+						return GcsvTableCollectionPtr();
+				}
+			}
+			// a probe must always reach an empty slot, and a chain must only go forward
+			unsigned int slot_count;
+			if(!in.get_u32(slot_count) || slot_count <= rows || (slot_count & (slot_count - 1)) != 0)
+				return GcsvTableCollectionPtr();
+			const unsigned int* slots = reinterpret_cast<const unsigned int*>(in.take(slot_count, sizeof(unsigned int)));
+			const unsigned int* chain = reinterpret_cast<const unsigned int*>(in.take(rows, sizeof(unsigned int)));
+			if(!slots || !chain)
+				return GcsvTableCollectionPtr();
+			size_t used = 0;
+			for(unsigned int slot = 0; slot < slot_count; slot++) {
+				if(slots[slot] > rows)
+					return GcsvTableCollectionPtr();
+				used += slots[slot] != 0;
+			}
+			if(used == slot_count)
+				return GcsvTableCollectionPtr();
+			for(unsigned int row = 0; row < rows; row++) {
+				if(chain[row] != 0 && (chain[row] <= row + 1 || chain[row] > rows))
+					return GcsvTableCollectionPtr();
+			}
+
+			GcsvHeaderPtr header(new GcsvHeader(name, columns));
+			tables->AddTable(GcsvTablePtr(new GcsvTable(header, file, rows, cells, slots, slot_count, chain)));
+		}
+		return tables;
+	}
+
+	// Writes the sidecar beside the text, through a temporary file so that a
+	// reader never sees half of one.  Gives up quietly if it can't.
+	static void Write(const std::string& path, const SidecarStamp& stamp, const GcsvTableCollection& tables) {
+		size_t strings_start = sizeof(kSidecarMagic) + 3 * 8 + 2 * 4;
+		foreach(named, tables.tables_) {
+			const GcsvTable& table = *named->second;
+			strings_start += SidecarWriter::StringSize(table.name()) + 4 + 4;
+			foreach(column, table.header()->columns()) {
+				strings_start += SidecarWriter::StringSize(*column);
+			}
+			strings_start += table.size() * (table.header()->size() * sizeof(GcsvCell) + sizeof(unsigned int))
+				+ 4 + table.key_index().slot_count() * sizeof(unsigned int);
+		}
+		if(strings_start + stamp.size > 0xffffffffULL)
+			return;
+
+		std::string bytes;
+		bytes.reserve(strings_start + static_cast<size_t>(stamp.size));
+		SidecarWriter out(bytes);
+		out.put(kSidecarMagic, sizeof(kSidecarMagic));
+		out.put_u64(stamp.time);
+		out.put_u64(stamp.size);
+		out.put_u64(stamp.hash);
+		out.put_u32(static_cast<unsigned int>(tables.tables_.size()));
+		out.put_u32(static_cast<unsigned int>(strings_start));
+		GcsvSourcePtr text;
+		foreach(named, tables.tables_) {
+			const GcsvTable& table = *named->second;
+			text = table.source();
+			out.put_string(table.name());
+			out.put_u32(table.header()->size());
+			foreach(column, table.header()->columns()) {
+				out.put_string(*column);
+			}
+			out.put_u32(static_cast<unsigned int>(table.size()));
+			for(int column = 0; column < table.header()->size(); column++) {
+				const GcsvCell* cells = table.column(column);
+				for(size_t row = 0; row < table.size(); row++) {
+					GcsvCell moved = { cells[row].offset + static_cast<unsigned int>(strings_start), cells[row].length };
+					out.put(&moved, sizeof(moved));
+				}
+			}
+			const GcsvIndex& keys = table.key_index();
+			out.put_u32(static_cast<unsigned int>(keys.slot_count()));
+			out.put(keys.slots(), keys.slot_count() * sizeof(unsigned int));
+			out.put(keys.chain(), table.size() * sizeof(unsigned int));
+		}
+		assert(bytes.size() == strings_start);
+		if(text)
+			out.put(text->data(), text->size());
+
+		boost::system::error_code error;
+		boost::filesystem::path temporary = boost::filesystem::unique_path(path + ".%%%%-%%%%", error);
+		if(error)
+			return;
+		{
+			std::ofstream file(temporary.string().c_str(), std::ios::binary);
+			file.write(bytes.data(), bytes.size());
+			if(!file)
+				error = boost::system::errc::make_error_code(boost::system::errc::io_error);
+		}
+		if(!error)
+			boost::filesystem::rename(temporary, path, error);
+		if(error)
+			boost::filesystem::remove(temporary, error);
+	}
 };
 
 
@@ -103,24 +513,368 @@ namespace gcsv {
 				auto x = (*table_collection)["test_name"];
 
 				for(auto it = x->begin(); it != x->end(); ++it) {
-					std::cout << (**it)["col1"] << std::endl;
+					std::cout << (*it)["col1"] << std::endl;
 				}
+				assert(x->size() == 2);
+				assert(x->get("row2")["col2"] == "r2c2");
+				assert(!x->ContainsKey("row3") && !x->get("row3").exists() && x->get("row3")["col1"] == "");
+				assert(!(*table_collection)["no_such_table"]);
+			}
+		}
+		const FieldMode field_modes[] = { kEagerFields, kLazyFields };
+		BOOST_FOREACH(FieldMode fields, field_modes) {
+			// a header on the line after the name, Windows line endings, short and long
+			// lines, and a repeated key
+			auto tables = gcsv::parse(GcsvSource::copy(
+				"~first\r\n  key,a,b\r\n// note\r\nk2,x\r\nk1,y,z,extra\r\nk2,dup,dup\r\n~second,id\r\n"), fields);
+			auto first = tables->get("first");
+			assert(first->size() == 3);
+			assert(first->get("k2")["a"] == "x" && first->get("k2")["b"] == "");
+			assert(first->get("k1").view("b") == "z");
+			assert(first->get("k1")["no_such_column"] == "");
+			assert(first->field(2, 0) == "k2" && first->column(2)[2].length == 3);
+			assert(tables->get("second")->size() == 0);
+
+			// lookup finds every line with a value, in order, whether or not the column is indexed
+			for(int indexed = 0; indexed < 2; indexed++) {
+				if(indexed)
+					first->AddIndex("b");
+				GcsvRow row;
+				assert(!row.exists() && row["a"].empty());
+				GcsvMatches repeated = first->lookup("key", "k2");
+				assert(repeated.next(row) && row["a"] == "x");
+				assert(repeated.next(row) && row["a"] == "dup");
+				assert(!repeated.next(row));
+				GcsvMatches missing_b = first->lookup("b", "");
+				assert(missing_b.next(row) && row["a"] == "x" && !missing_b.next(row));
+				GcsvMatches dup_b = first->lookup("b", "dup");
+				assert(dup_b.next(row) && row["key"] == "k2" && !dup_b.next(row));
+				assert(!first->lookup("b", "nothing").next(row));
+				assert(!first->lookup("no_such_column", "x").next(row));
+			}
+		}
+		{
+			// parsing each table on a pool gives the tables parsing them in turn does
+			auto source = GcsvSource::copy(
+				"prelude,ignored\n~a,k,v\nk1,~not a table\n  ~b\nid,w\nb1,2\n~a,k,v\nk1,second\n~\nlost\n\t~c,id\nc1");
+			work_pool pool(3);
+			auto serial = gcsv::parse(source);
+			auto parallel = gcsv::parse(source, pool);
+			const char* names[] = { "a", "b", "c" };
+			BOOST_FOREACH(const char* name, names) {
+				assert(parallel->get(name)->size() == serial->get(name)->size());
 			}
+			assert(parallel->get("a")->get("k1")["v"] == "~not a table");
+			assert(parallel->get("b")->get("b1")["w"] == "2");
+			assert(parallel->get("c")->ContainsKey("c1"));
+			assert(!serial->get("") && !parallel->get(""));
+		}
+		{
+			// a visit sees each table as it comes, and can pass over one or stop part way
+			auto source = GcsvSource::copy("~first,key,a\nk1,1\nk2,2\n~second\nid,b\ns1,x\n~third,id\nt1\nt2\n");
+			RecordingVisitor everything("", "");
+			gcsv::visit(source, everything);
+			assert(everything.seen == "<first:key k1 k2><second:id s1><third:id t1 t2>");
+			RecordingVisitor skipping("second", "t1");
+			gcsv::visit(source, skipping);
+			assert(skipping.seen == "<first:key k1 k2><second><third:id t1");
+			RecordingVisitor stopping("", "k1");
+			gcsv::visit(source, stopping);
+			assert(stopping.seen == "<first:key k1");
+		}
+		{
+			// binding decodes each line into a struct, leaving alone fields whose column the table lacks
+			auto tables = gcsv::parse(GcsvSource::copy("~places,name,height,depth\nhome,1.5,3\ncave,-20\n"));
+			auto places = tables->get("places");
+			GcsvBinding<BoundPlace> binding(*places);
+			binding.field("name", &BoundPlace::name).field("height", &BoundPlace::height)
+				.field("depth", &BoundPlace::where, &BoundPlace::Position::depth)
+				.field("note", &BoundPlace::note);
+			BoundPlace place;
+			place.note = "kept";
+			binding.decode(0, place);
+			assert(place.name == "home" && place.height == 1.5 && place.where.depth == 3 && place.note == "kept");
+			binding.decode(1, place);
+			assert(place.name == "cave" && place.height == -20 && place.where.depth == 0);
+		}
+		{
+			// the first read compiles a sidecar and the next one uses it, until the text changes
+			const std::string path = "test_gcsv_sidecar.csv";
+			const std::string compiled = sidecar_path(path);
+			{
+				std::ofstream text(path.c_str(), std::ios::binary);
+				text << "~places,name,x\nhome,1\nspawn,2\n~empty,id\n";
+			}
+			// a lazy table is split all the way to be written out
+			assert(!read(path, kUseSidecar, kLazyFields)->compiled());
+			assert(boost::filesystem::exists(compiled));
+			auto tables = read(path, kUseSidecar);
+			assert(tables->compiled());
+			assert(tables->get("places")->size() == 2);
+			assert(tables->get("places")->get("spawn")["x"] == "2");
+			assert(!tables->get("places")->ContainsKey("nowhere"));
+			tables->get("places")->AddIndex("x");
+			GcsvRow home;
+			assert(tables->get("places")->lookup("x", "1").next(home) && home["name"] == "home");
+			assert(tables->get("empty")->size() == 0);
+			tables.reset();
+
+			// the same size and time, so only the hash can tell
+			std::time_t written = boost::filesystem::last_write_time(path);
+			{
+				std::ofstream text(path.c_str(), std::ios::binary);
+				text << "~places,name,x\nhome,1\nspawn,3\n~empty,id\n";
+			}
+			boost::filesystem::last_write_time(path, written);
+			tables = read(path, kUseSidecar);
+			assert(!tables->compiled());
+			assert(tables->get("places")->get("spawn")["x"] == "3");
+			tables.reset();
+			assert(read(path, kUseSidecar)->compiled());
+
+			// a damaged sidecar is ignored and rewritten
+			{
+				std::ofstream damaged(compiled.c_str(), std::ios::binary);
+				damaged << "GCSVB";
+			}
+			assert(!read(path, kUseSidecar)->compiled());
+			assert(read(path, kUseSidecar)->get("places")->get("home")["x"] == "1");
+			boost::filesystem::remove(path);
+			boost::filesystem::remove(compiled);
 		}
 		// out of scope, all gcsv objects should be cleaned up
 		std::cout << "finished testing gcsv" << std::endl;
 	}
-	
-	std::shared_ptr<GcsvTableCollection> read(std::string path) {
-		auto reader = boost::shared_ptr<GcsvReader>(new GcsvReader());
 
-		// To read the Gcsv, we iterate over all of the trimmed, valid lines in the file
-		// using the GcsvReader to add them to a new GcsvTableCollection.
-		io_helpers::iterate_file(boost::bind(&GcsvReader::HandleLine, reader, _1), path);
-		reader->Finish();
+	// parses on the pool if there is one
+	std::shared_ptr<GcsvTableCollection> ReadFile(const std::string& path, work_pool* pool, SidecarMode sidecar, FieldMode fields) {
+		auto source = GcsvSource::map(path);
+		if(sidecar == kUseSidecar) {
+			SidecarStamp stamp(path, *source);
+			auto compiled = sidecar_path(path);
+			auto tables = GcsvSidecar::Load(compiled, stamp);
+			if(tables)
+				return tables;
+			tables = pool ? parse(source, *pool, fields) : parse(source, fields);
+			GcsvSidecar::Write(compiled, stamp, *tables);
+			return tables;
+		}
+		return pool ? parse(source, *pool, fields) : parse(source, fields);
+	}
+
+	std::shared_ptr<GcsvTableCollection> read(std::string path, SidecarMode sidecar, FieldMode fields) {
+		return ReadFile(path, NULL, sidecar, fields);
+	}
+
+	std::shared_ptr<GcsvTableCollection> read(std::string path, work_pool& pool, SidecarMode sidecar, FieldMode fields) {
+		return ReadFile(path, &pool, sidecar, fields);
+	}
+
+	std::string sidecar_path(const std::string& file) {
+		return boost::filesystem::path(file).replace_extension(".gcsvb").string();
+	}
+
+	// To read the Gcsv, we visit all of its lines
+	// with a GcsvReader, which adds them to a new GcsvTableCollection.
+	std::shared_ptr<GcsvTableCollection> parse(std::shared_ptr<GcsvSource> source, FieldMode fields) {
+		GcsvReader reader(source, fields);
+		visit(source, reader);
+		return reader.GetTableCollection();
+	}
+
+	void visit(std::string file, GcsvVisitor& visitor) {
+		visit(GcsvSource::map(file), visitor);
+	}
+
+	// We iterate over all of the trimmed, valid lines in the source,
+	// stopping early if the visitor asks.
+	void visit(std::shared_ptr<GcsvSource> source, GcsvVisitor& visitor) {
+		GcsvScanner scanner(visitor);
+		if(ScanLines(source->data(), source->data() + source->size(), scanner))
+			scanner.Finish();
+	}
+
+	// Each table is everything from its marker line to the next one, so the
+	// tables can be parsed apart from one another, then added in the order the
+	// file has them -- the first of two tables with the same name still wins.
+	std::shared_ptr<GcsvTableCollection> parse(std::shared_ptr<GcsvSource> source, work_pool& pool, FieldMode fields) {
+		const char* begin = source->data();
+		const char* end = begin + source->size();
+		std::vector<const char*> starts = FindTableStarts(begin, end);
+		if(starts.size() < 2)
+			return parse(source, fields);
 
-		return reader->GetTableCollection();
+		std::vector<GcsvTablePtr> tables(starts.size());
+		pool.run_all(starts.size(), [&](size_t i) {
+			GcsvReader reader(source, fields);
+			GcsvScanner scanner(reader);
+			ScanLines(starts[i], i + 1 < starts.size() ? starts[i + 1] : end, scanner);
+			scanner.Finish();
+			tables[i] = reader.GetLastTable();
+		});
+
+		GcsvTableCollectionPtr collection(new GcsvTableCollection());
+		foreach(table, tables) {
+			if(*table)
+				collection->AddTable(*table);
+		}
+		return collection;
+	}
+
+	// average ms per read, going through every location's name so the fields are touched
+	double TimeRead(const std::string& path, SidecarMode sidecar, int runs, size_t& found) {
+		using boost::posix_time::microsec_clock;
+		auto start = microsec_clock::universal_time();
+		for(int i = 0; i < runs; i++) {
+			auto tables = read(path, sidecar);
+			auto locations = tables->get("locations");
+			for(auto row = locations->begin(); row != locations->end(); ++row)
+				found += row->view("name").size();
+		}
+		return (microsec_clock::universal_time() - start).total_microseconds() / 1e3 / runs;
 	}
+
+	void benchmark_gcsv(int rows, int threads) {
+		using boost::posix_time::microsec_clock;
+		std::cout << "benchmarking gcsv..." << std::endl;
+		const std::string path = "benchmark_gcsv.csv";
+		{
+			std::ofstream teleports(path.c_str());
+			teleports << "~locations,name,x,y,z" << std::endl;
+			for(int i = 0; i < rows; i++)
+				teleports << "loc" << i << "," << (i % 50) * 10 - 123 << ",64," << (i / 50) * 10 + 250 << std::endl;
+			teleports << "~teleports,id,a,b" << std::endl;
+			for(int i = 0; i < rows; i++)
+				teleports << "t" << i << ",loc" << i << ",loc" << (i + 1) % rows << std::endl;
+		}
+
+		const int runs = 5;
+		size_t found = 0;
+		double text_ms = TimeRead(path, kTextOnly, runs, found);
+		read(path, kUseSidecar);
+		double sidecar_ms = TimeRead(path, kUseSidecar, runs, found);
+		std::cout << 2 * rows << " lines (" << boost::filesystem::file_size(path) << " bytes): "
+			<< text_ms << " ms to read the text, " << 2 * rows / text_ms * 1000 << " lines/sec; "
+			<< sidecar_ms << " ms to load the sidecar (" << found << ")" << std::endl;
+		boost::filesystem::remove(sidecar_path(path));
+
+		// every location by key, then the teleports from a few locations with and without an index
+		auto tables = read(path);
+		auto locations = tables->get("locations");
+		auto teleports = tables->get("teleports");
+		auto start = microsec_clock::universal_time();
+		for(int i = 0; i < rows; i++)
+			found += locations->get(locations->field(i, 0).str()).exists();
+		double key_ms = (microsec_clock::universal_time() - start).total_microseconds() / 1e3;
+		const int lookups = 100;
+		double lookup_ms[2];
+		for(int indexed = 0; indexed < 2; indexed++) {
+			start = microsec_clock::universal_time();
+			if(indexed)
+				teleports->AddIndex("a");
+			GcsvRow teleport;
+			for(int i = 0; i < lookups; i++) {
+				GcsvMatches from = teleports->lookup("a", locations->field(i * (rows / lookups), 0));
+				while(from.next(teleport))
+					found++;
+			}
+			lookup_ms[indexed] = (microsec_clock::universal_time() - start).total_microseconds() / 1e3;
+		}
+		std::cout << rows << " keys looked up in " << key_ms << " ms; " << lookups << " lookups by another column: "
+			<< lookup_ms[0] << " ms scanning, " << lookup_ms[1] << " ms indexing it first (" << found << ")" << std::endl;
+		tables.reset();
+		boost::filesystem::remove(path);
+
+		// a wide table, of which only two columns are read
+		const int wide_columns = 40;
+		std::stringstream wide;
+		wide << "~worlds,name";
+		for(int column = 1; column < wide_columns; column++)
+			wide << ",note" << column;
+		wide << std::endl;
+		for(int i = 0; i < rows; i++) {
+			wide << "world" << i;
+			for(int column = 1; column < wide_columns; column++)
+				wide << ",annotation " << column;
+			wide << std::endl;
+		}
+		auto wide_source = GcsvSource::copy(wide.str());
+		const FieldMode field_modes[] = { kEagerFields, kLazyFields };
+		double wide_ms[2];
+		for(int mode = 0; mode < 2; mode++) {
+			auto start = microsec_clock::universal_time();
+			for(int i = 0; i < runs; i++) {
+				auto table = parse(wide_source, field_modes[mode])->get("worlds");
+				for(size_t row = 0; row < table->size(); row += 100)
+					found += table->field(row, 0).size() + table->field(row, wide_columns / 2).size();
+			}
+			wide_ms[mode] = (microsec_clock::universal_time() - start).total_microseconds() / 1e3 / runs;
+		}
+		std::cout << rows << " lines of " << wide_columns << " columns, reading every 100th: "
+			<< wide_ms[0] << " ms split as read, " << wide_ms[1] << " ms split lazily (" << found << ")" << std::endl;
+
+		// the same number of lines as the teleports, in many tables
+		const int table_count = 48;
+		std::stringstream many;
+		for(int table = 0; table < table_count; table++) {
+			many << "~locations" << table << ",name,x,y,z" << std::endl;
+			for(int i = 0; i < 2 * rows / table_count; i++)
+				many << "loc" << i << "," << (i % 50) * 10 - 123 << ",64," << (i / 50) * 10 + 250 << std::endl;
+		}
+		auto many_source = GcsvSource::copy(many.str());
+		work_pool pool(threads);
+		double many_ms[2];
+		for(int parallel = 0; parallel < 2; parallel++) {
+			auto start = microsec_clock::universal_time();
+			for(int i = 0; i < runs; i++)
+				found += (parallel ? parse(many_source, pool) : parse(many_source))->get("locations0")->size();
+			many_ms[parallel] = (microsec_clock::universal_time() - start).total_microseconds() / 1e3 / runs;
+		}
+		std::cout << table_count << " tables: " << many_ms[0] << " ms on one thread, "
+			<< many_ms[1] << " ms on " << threads << " (" << found << ")" << std::endl;
+	}
+}
+
+
+
+
+//////////////////// GcsvSource Implementation
+
+GcsvSource::GcsvSource() : data_(NULL), size_(0) {
+}
+
+GcsvSource::~GcsvSource() {
+}
+
+std::shared_ptr<GcsvSource> GcsvSource::map(const std::string& path) {
+	using namespace boost::interprocess;
+	std::shared_ptr<GcsvSource> source(new GcsvSource());
+	if(!boost::filesystem::exists(path))
+		throw std::exception("failed to open file");
+	// an empty file can't be mapped, and has nothing to map anyway
+	if(boost::filesystem::file_size(path) == 0)
+		return source;
+	file_mapping file(path.c_str(), read_only);
+	source->region_.reset(new mapped_region(file, read_only));
+	source->data_ = static_cast<const char*>(source->region_->get_address());
+	source->size_ = source->region_->get_size();
+	return source;
+}
+
+std::shared_ptr<GcsvSource> GcsvSource::copy(const std::string& text) {
+	std::shared_ptr<GcsvSource> source(new GcsvSource());
+	source->text_ = text;
+	source->data_ = source->text_.data();
+	source->size_ = source->text_.size();
+	return source;
+}
+
+const char* GcsvSource::data() const {
+	return data_;
+}
+
+size_t GcsvSource::size() const {
+	return size_;
 }
 
 
@@ -128,8 +882,8 @@ namespace gcsv {
 
 //////////////////// GcsvHeader Implementation
 
-// Adds the columns to the mapping in order.
-GcsvHeader::GcsvHeader(std::string name, const vector_str& columns) : fields_(), name_(name) {
+// Adds the columns to the mapping in order.  A name used twice finds the first of its columns.
+GcsvHeader::GcsvHeader(std::string name, const vector_str& columns) : columns_(columns), fields_(), name_(name) {
 	int count = 0;
 	for(auto it = columns.begin(); it != columns.end(); ++it) {
 		fields_.insert(std::make_pair (*it, count));
@@ -140,114 +894,348 @@ GcsvHeader::GcsvHeader(std::string name, const vector_str& columns) : fields_(),
 GcsvHeader::~GcsvHeader() {
 	//std::cout << " deleting GcsvHeader " << name() << std::endl;
 }
-int GcsvHeader::operator[](const std::string& key) {
-	return fields_.find(key)->second;
+int GcsvHeader::operator[](const std::string& key) const {
+	auto found = fields_.find(key);
+	return found == fields_.end() ? -1 : found->second;
 }
-bool GcsvHeader::ContainsKey(const std::string& key) {
-	return fields_.count(key) == 0;
+bool GcsvHeader::ContainsKey(const std::string& key) const {
+	return fields_.count(key) > 0;
 }
-int GcsvHeader::size() { 
-	return fields_.size();
+int GcsvHeader::size() const {
+	return columns_.size();
 }
-std::string GcsvHeader::name() {
+std::string GcsvHeader::name() const {
 	return name_;
 }
-std::string GcsvHeader::GetFirstColumnName() {
+std::string GcsvHeader::GetFirstColumnName() const {
 	return first_field_;
 }
+const vector_str& GcsvHeader::columns() const {
+	return columns_;
+}
+
+
+
+
+//////////////////// GcsvRow Implementation
+
+GcsvRow::GcsvRow() : table_(NULL), row_(0) {
+}
+
+GcsvRow::GcsvRow(const GcsvTable* table, size_t row) : table_(table), row_(row) {
+}
+
+std::string GcsvRow::operator[](const std::string& key) const {
+	return view(key).str();
+}
+std::string GcsvRow::get(const std::string& key) const {
+	return view(key).str();
+}
+
+util::string_view GcsvRow::view(const std::string& key) const {
+	if(!exists())
+		return util::string_view();
+	int column = (*table_->header())[key];
+	if(column < 0)
+		return util::string_view();
+	return table_->field(row_, column);
+}
+
+bool GcsvRow::exists() const {
+	return table_ && row_ < table_->size();
+}
+
+size_t GcsvRow::row() const {
+	return row_;
+}
 
 
 
 
-//////////////////// GcsvLine Implementation
+//////////////////// GcsvIndex Implementation
 
-// values are copied from the input vector
-GcsvLine::GcsvLine(std::shared_ptr<GcsvHeader> header, const vector_str& fields) {
-	header_ = header;
-	values_ = std::shared_ptr<std::string>(new std::string[header->size()], my_array_deleter<std::string>());
-	std::string* values_ptr = values_.get();
-	for(int i = 0; i < fields.size(); i++) {
-		values_ptr[i] = fields.at(i);
+GcsvIndex::GcsvIndex() : table_(NULL), column_(0), slots_(NULL), slot_count_(0), next_(NULL) {
+}
+
+// Lines are added last to first, each going on the front of its value's chain,
+// so each chain ends up in file order and its slot holds the first line.
+void GcsvIndex::Build(const GcsvTable& table, int column) {
+	table_ = &table;
+	column_ = column;
+	size_t rows = table.size();
+	// at most half full, so probes stay short
+	slot_count_ = 2;
+	while(slot_count_ < 2 * rows)
+		slot_count_ *= 2;
+	owned_slots_.assign(slot_count_, 0);
+	owned_next_.assign(rows + 1, 0);
+	size_t mask = slot_count_ - 1;
+	for(size_t row = rows; row-- > 0; ) {
+		util::string_view value = table.field(row, column);
+		size_t slot = static_cast<size_t>(Hash(value)) & mask;
+		while(owned_slots_[slot] != 0 && table.field(owned_slots_[slot] - 1, column) != value)
+			slot = (slot + 1) & mask;
+		owned_next_[row] = owned_slots_[slot];
+		owned_slots_[slot] = static_cast<unsigned int>(row + 1);
 	}
-	for(int i = fields.size(); i < header->size(); i++) {
-		values_ptr[i] = std::string("");
+	slots_ = &owned_slots_[0];
+	next_ = &owned_next_[0];
+}
+
+void GcsvIndex::Attach(const GcsvTable& table, int column, const unsigned int* slots, size_t slot_count, const unsigned int* next) {
+	table_ = &table;
+	column_ = column;
+	slots_ = slots;
+	slot_count_ = slot_count;
+	next_ = next;
+}
+
+size_t GcsvIndex::find(util::string_view key) const {
+	if(slot_count_ == 0)
+		return table_ ? table_->size() : 0;
+	size_t mask = slot_count_ - 1;
+	for(size_t slot = static_cast<size_t>(Hash(key)) & mask; slots_[slot] != 0; slot = (slot + 1) & mask) {
+		size_t row = slots_[slot] - 1;
+		if(table_->field(row, column_) == key)
+			return row;
 	}
+	return table_->size();
+}
+
+size_t GcsvIndex::next(size_t row) const {
+	return next_[row] != 0 ? next_[row] - 1 : table_->size();
 }
 
-// values_ should be automatically deleted at this point
-// header_ may be shared by other GcsvLines.
-GcsvLine::~GcsvLine() {
-	//std::cout << " deleting GcsvLine " << (values_.get())[0] << std::endl;
+const unsigned int* GcsvIndex::slots() const {
+	return slots_;
 }
 
-std::string GcsvLine::operator[](const std::string& key) {
-	int index = (*header_)[key];
-	assert(index >= 0 && index < header_->size());
-	return values_.get()[index];
+size_t GcsvIndex::slot_count() const {
+	return slot_count_;
 }
-std::string GcsvLine::get(const std::string& key) {
-	return this->operator[](key);
+
+const unsigned int* GcsvIndex::chain() const {
+	return next_;
+}
+
+unsigned long long GcsvIndex::Hash(util::string_view key) {
+	return HashBytes(key.data(), key.size());
+}
+
+
+GcsvMatches::GcsvMatches(const GcsvTable* table, const GcsvIndex* index, int column, util::string_view key)
+	: table_(table), index_(index), column_(column), key_(key), next_(0) {
+	if(column_ < 0)
+		next_ = table_->size();
+	else if(index_)
+		next_ = index_->find(key_);
 }
 
+bool GcsvMatches::next(GcsvRow& row) {
+	if(!index_) {
+		while(next_ < table_->size() && table_->field(next_, column_) != key_)
+			next_++;
+	}
+	if(next_ >= table_->size())
+		return false;
+	row = GcsvRow(table_, next_);
+	next_ = index_ ? index_->next(next_) : next_ + 1;
+	return true;
+}
+
+
+GcsvRowIterator::GcsvRowIterator(const GcsvTable* table, size_t row) : row_(table, row) {
+}
+
+GcsvRowIterator::reference GcsvRowIterator::operator*() const {
+	return row_;
+}
+
+GcsvRowIterator::pointer GcsvRowIterator::operator->() const {
+	return &row_;
+}
+
+GcsvRowIterator& GcsvRowIterator::operator++() {
+	++row_.row_;
+	return *this;
+}
+
+GcsvRowIterator GcsvRowIterator::operator++(int) {
+	GcsvRowIterator before = *this;
+	++row_.row_;
+	return before;
+}
+
+bool GcsvRowIterator::operator==(const GcsvRowIterator& other) const {
+	return row_.table_ == other.row_.table_ && row_.row_ == other.row_.row_;
+}
+
+bool GcsvRowIterator::operator!=(const GcsvRowIterator& other) const {
+	return !(*this == other);
+}
 
 
 
 
 //////////////////// GcsvTable Implementation
 
-GcsvTable::GcsvTable(std::shared_ptr<GcsvHeader> header) : name_(header->name()), header_(header), lines_map_(), lines_() {
-	mapping_key_ = header->GetFirstColumnName();
+GcsvTable::GcsvTable(std::shared_ptr<GcsvHeader> header, GcsvSourcePtr source, gcsv::FieldMode fields)
+	: name_(header->name()), header_(header), source_(source), rows_(0), columns_(header->size()),
+	column_cells_(header->size()), keys_(), indexes_(), lazy_(fields == gcsv::kLazyFields) {
+}
+GcsvTable::GcsvTable(std::shared_ptr<GcsvHeader> header, GcsvSourcePtr source, size_t rows,
+	const std::vector<const GcsvCell*>& columns, const unsigned int* key_slots, size_t key_slot_count,
+	const unsigned int* key_chain)
+	: name_(header->name()), header_(header), source_(source), rows_(rows), columns_(),
+	column_cells_(columns), keys_(), indexes_(), lazy_(false) {
+	keys_.Attach(*this, 0, key_slots, key_slot_count, key_chain);
 }
 GcsvTable::~GcsvTable() {
 	//std::cout << " deleting GcsvTable " << name() << std::endl;
 }
-void GcsvTable::Add(GcsvLinePtr line) {
-	lines_map_.insert(std::make_pair((*line)[mapping_key_], line));
-	lines_.push_back(line);
+
+void GcsvTable::Add(const std::vector<util::string_view>& fields) {
+	const char* base = source_->data();
+	for(size_t column = 0; column < columns_.size(); column++) {
+		GcsvCell cell = { 0, 0 };
+		if(column < fields.size()) {
+			cell.offset = static_cast<unsigned int>(fields[column].data() - base);
+			cell.length = static_cast<unsigned int>(fields[column].size());
+		}
+		columns_[column].push_back(cell);
+	}
+	rows_++;
+}
+
+// Only the key is found now: it ends at the first comma.
+void GcsvTable::AddLine(util::string_view line) {
+	const char* base = source_->data();
+	GcsvCell whole = { static_cast<unsigned int>(line.data() - base), static_cast<unsigned int>(line.size()) };
+	size_t comma = line.find(',');
+	GcsvCell key = { whole.offset, static_cast<unsigned int>(comma == util::string_view::npos ? line.size() : comma) };
+	lines_.push_back(whole);
+	columns_[0].push_back(key);
+	rows_++;
+}
+
+void GcsvTable::Split(size_t row) const {
+	if(columns_.size() > 1 && columns_[1].size() != rows_) {
+		for(size_t column = 1; column < columns_.size(); column++) {
+			columns_[column].resize(rows_);
+			column_cells_[column] = &columns_[column][0];
+		}
+	}
+	const char* base = source_->data();
+	util::splitter fields(util::string_view(base + lines_[row].offset, lines_[row].length), ',');
+	util::string_view text;
+	fields.next(text);
+	for(size_t column = 1; column < columns_.size() && fields.next(text); column++) {
+		GcsvCell cell = { static_cast<unsigned int>(text.data() - base), static_cast<unsigned int>(text.size()) };
+		columns_[column][row] = cell;
+	}
+	split_[row] = 1;
+}
+
+void GcsvTable::Finish() {
+	for(size_t column = 0; column < columns_.size(); column++)
+		column_cells_[column] = columns_[column].empty() ? NULL : &columns_[column][0];
+	if(lazy_)
+		split_.assign(rows_, 0);
+	keys_.Build(*this, 0);
 }
 
-bool GcsvTable::ContainsKey(const std::string& key) {
-	return lines_map_.count(key) > 0;
+void GcsvTable::AddIndex(const std::string& column) {
+	int index = (*header_)[column];
+	if(index < 0 || index == 0 || indexes_.count(index))
+		return;
+	std::shared_ptr<GcsvIndex> built(new GcsvIndex());
+	built->Build(*this, index);
+	indexes_[index] = built;
 }
 
-GcsvLinePtr GcsvTable::operator[](const std::string& key) {
-	return lines_map_.find(key)->second;
+GcsvMatches GcsvTable::lookup(const std::string& column, util::string_view key) const {
+	int index = (*header_)[column];
+	if(index == 0)
+		return GcsvMatches(this, &keys_, index, key);
+	auto found = indexes_.find(index);
+	return GcsvMatches(this, found == indexes_.end() ? NULL : found->second.get(), index, key);
 }
-GcsvLinePtr GcsvTable::get(const std::string& key) {
-	return lines_map_.find(key)->second;
+
+bool GcsvTable::ContainsKey(const std::string& key) const {
+	return keys_.find(key) != rows_;
 }
 
-std::string GcsvTable::name() { 
+GcsvRow GcsvTable::operator[](const std::string& key) const {
+	return GcsvRow(this, keys_.find(key));
+}
+GcsvRow GcsvTable::get(const std::string& key) const {
+	return GcsvRow(this, keys_.find(key));
+}
+
+std::string GcsvTable::name() const {
 	return name_;
 }
 
-std::vector<GcsvLinePtr>::iterator GcsvTable::begin() {
-	return lines_.begin();
+size_t GcsvTable::size() const {
+	return rows_;
+}
+
+GcsvTable::iterator GcsvTable::begin() const {
+	return iterator(this, 0);
 }
 
-std::vector<GcsvLinePtr>::iterator GcsvTable::end() {
-	return lines_.end();
+GcsvTable::iterator GcsvTable::end() const {
+	return iterator(this, rows_);
 }
 
-std::shared_ptr<GcsvHeader> GcsvTable::header() { return header_; }
+std::shared_ptr<GcsvHeader> GcsvTable::header() const { return header_; }
+
+util::string_view GcsvTable::field(size_t row, int column) const {
+	if(lazy_ && column > 0 && !split_[row])
+		Split(row);
+	const GcsvCell& cell = column_cells_[column][row];
+	return util::string_view(source_->data() + cell.offset, cell.length);
+}
+
+GcsvSourcePtr GcsvTable::source() const {
+	return source_;
+}
+
+const GcsvCell* GcsvTable::column(int column) const {
+	for(size_t row = 0; lazy_ && column > 0 && row < rows_; row++) {
+		if(!split_[row])
+			Split(row);
+	}
+	return column_cells_[column];
+}
+
+const GcsvIndex& GcsvTable::key_index() const {
+	return keys_;
+}
 
 
 
 
 //////////////////// GcsvTableCollection Implementation
 
-GcsvTableCollection::GcsvTableCollection() : tables_() { }
+GcsvTableCollection::GcsvTableCollection() : tables_(), compiled_(false) { }
 GcsvTableCollection::~GcsvTableCollection() {
 	//std::cout << " deleting GcsvTableCollection " << std::endl;
 }
 
+// an empty pointer if there's no table of that name
 std::shared_ptr<GcsvTable> GcsvTableCollection::get(const std::string& key) {
-	return tables_.find(key)->second;
+	auto found = tables_.find(key);
+	return found == tables_.end() ? std::shared_ptr<GcsvTable>() : found->second;
 }
 std::shared_ptr<GcsvTable> GcsvTableCollection::operator[](const std::string& key) {
-	return tables_.find(key)->second;
+	return get(key);
 }
 
 void GcsvTableCollection::AddTable(std::shared_ptr<GcsvTable> table) {
 	tables_.insert(std::make_pair(table->name(), table));
-}
\ No newline at end of file
+}
+
+bool GcsvTableCollection::compiled() const {
+	return compiled_;
+}
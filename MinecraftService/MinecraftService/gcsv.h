@@ -4,108 +4,403 @@
 #include <algorithm>
 #include <cstdlib>
 #include <iostream>
+#include <iterator>
 #include <vector>
 #include <map>
+#include <memory>
+#include <functional>
 #include <assert.h>
+#include "../../shared/string_view.hpp"
 
 typedef std::vector<std::string> vector_str;
 
+class GcsvSource;
+class GcsvHeader;
 class GcsvTableCollection;
+class GcsvVisitor;
+class work_pool;
 
 namespace gcsv {
 	const char kGcsvInitialCharacter = '~';
 	void test_gcsv();
-	std::shared_ptr<GcsvTableCollection> read(std::string file);
+
+	// Whether read may use a compiled copy of the file: a .gcsvb sidecar next to
+	// it, written the first time the file is read and used for as long as the
+	// file's time, size and hash still match.  A sidecar that can't be written
+	// is simply not used.
+	enum SidecarMode {
+		kTextOnly,
+		kUseSidecar
+	};
+
+	// When a table finds where each field of a line is.  kLazyFields only finds the
+	// key when the file is read, and splits the rest of a line the first time one
+	// of its fields is asked for, so reading a few columns of a wide table costs
+	// little more than reading its keys.  A lazy table changes as it is read, so
+	// only one thread may read it at a time.
+	enum FieldMode {
+		kEagerFields,
+		kLazyFields
+	};
+
+	// Maps the file and indexes its fields in place.  The tables point into the
+	// mapping, which stays open until the last of them goes away.  Tables loaded
+	// from a sidecar already have every field, whatever the field mode.
+	std::shared_ptr<GcsvTableCollection> read(std::string file, SidecarMode sidecar = kTextOnly, FieldMode fields = kEagerFields);
+
+	// The same, parsing each table of the file on the pool, for files with many
+	// large tables.  The tables are the same as read would give.  Must not be
+	// called from one of the pool's own threads.
+	std::shared_ptr<GcsvTableCollection> read(std::string file, work_pool& pool,
+		SidecarMode sidecar = kTextOnly, FieldMode fields = kEagerFields);
+
+	// where read keeps the compiled copy of file: teleports.csv -> teleports.gcsvb
+	std::string sidecar_path(const std::string& file);
+
+	// Indexes gcsv that is already in memory.
+	std::shared_ptr<GcsvTableCollection> parse(std::shared_ptr<GcsvSource> source, FieldMode fields = kEagerFields);
+	std::shared_ptr<GcsvTableCollection> parse(std::shared_ptr<GcsvSource> source, work_pool& pool, FieldMode fields = kEagerFields);
+
+	// What a GcsvVisitor wants done after each call.
+	enum VisitResult {
+		kContinue,
+		// pass over the rest of this table
+		kSkipTable,
+		// read no further
+		kStop
+	};
+
+	// Reads the file a line at a time, handing the visitor each table as it
+	// goes, without keeping any of it.
+	void visit(std::string file, GcsvVisitor& visitor);
+	void visit(std::shared_ptr<GcsvSource> source, GcsvVisitor& visitor);
+
+	// Times reading a teleports.csv with the given number of locations and
+	// teleports, from the text and from its sidecar, then a file of that many
+	// lines split into many tables, on one thread and on threads threads.
+	void benchmark_gcsv(int rows, int threads);
 }
 
+namespace boost { namespace interprocess { class mapped_region; } }
+
+// The bytes of a gcsv file.  A file is mapped into memory rather than read, so
+// loading it costs no copy; on Windows the file can't be replaced while mapped,
+// so keep the tables only as long as it takes to pull out what's needed.
+class GcsvSource {
+public:
+	// Maps the file.  Throws if it can't be opened.
+	static std::shared_ptr<GcsvSource> map(const std::string& path);
+
+	// Keeps a copy of text.
+	static std::shared_ptr<GcsvSource> copy(const std::string& text);
+
+	~GcsvSource();
+
+	const char* data() const;
+	size_t size() const;
+
+private:
+	GcsvSource();
+
+	std::unique_ptr<boost::interprocess::mapped_region> region_;
+	std::string text_;
+	const char* data_;
+	size_t size_;
+};
+typedef std::shared_ptr<GcsvSource> GcsvSourcePtr;
+
 class GcsvHeader {
 public:
 	GcsvHeader(std::string name, const vector_str& columns);
 	~GcsvHeader();
-	int operator[](const std::string& key);
-	bool ContainsKey(const std::string& key);
-	int size();
-	std::string name(); 
-	std::string GetFirstColumnName();
+	// the column's index, or -1 if the header has no such column
+	int operator[](const std::string& key) const;
+	bool ContainsKey(const std::string& key) const;
+	int size() const;
+	std::string name() const;
+	std::string GetFirstColumnName() const;
+	// the column names in order
+	const vector_str& columns() const;
 
 private:
+	vector_str columns_;
 	std::map<std::string, int> fields_;
 	std::string name_;
 	std::string first_field_;
 };
+typedef std::shared_ptr<GcsvHeader> GcsvHeaderPtr;
+
+// Is told of each table of a gcsv file in turn, by gcsv::visit.  The fields are
+// views into the source, so they are only valid while it is, and the vector
+// holding them is reused for the next line.
+class GcsvVisitor {
+public:
+	virtual ~GcsvVisitor() {}
+	// A table's name has been read; its header comes next.
+	virtual gcsv::VisitResult StartTable(util::string_view name) { return gcsv::kContinue; }
+	virtual gcsv::VisitResult Header(std::shared_ptr<GcsvHeader> header) { return gcsv::kContinue; }
+	// One line of the table.  It may have fewer fields than the header, or more.
+	virtual gcsv::VisitResult Row(const std::vector<util::string_view>& fields) = 0;
+	// A visitor that would rather split lines itself returns false here, and is
+	// handed each line whole, through RowLine, instead of through Row.
+	virtual bool SplitsRows() const { return true; }
+	virtual gcsv::VisitResult RowLine(util::string_view line) { return gcsv::kContinue; }
+	// The table has ended, whether or not its lines were skipped.
+	virtual gcsv::VisitResult EndTable() { return gcsv::kContinue; }
+};
 
-// http://stackoverflow.com/a/627663
-template<typename T>
-struct my_array_deleter
-{
-   void operator()(T* p)
-   {
-      delete [] p;
-   }
+// Where one field lies in a GcsvSource.
+struct GcsvCell {
+	unsigned int offset;
+	unsigned int length;
 };
-typedef std::shared_ptr<GcsvHeader> GcsvHeaderPtr;
 
-// GcsvLine is a glorified map<string,string>.
-// The values are stored in a simple array, and indices are retrieved through the header
-// which maps column names to integer indices.
-class GcsvLine {
+class GcsvTable;
+
+// One line of a GcsvTable: a glorified map<string,string>, looked up through the
+// header, which maps column names to indices.  A row is only its table and its
+// line number, so it costs nothing to make or copy, but it is only valid while
+// its table is.  A row of a key that isn't in the table reads as all empty.
+class GcsvRow {
 public:
-	GcsvLine(std::shared_ptr<GcsvHeader> header, const vector_str& fields); 
-	~GcsvLine();
-	std::string operator[](const std::string& key);
-	std::string get(const std::string& key);
+	// a row of no table, which doesn't exist
+	GcsvRow();
+	GcsvRow(const GcsvTable* table, size_t row);
+	std::string operator[](const std::string& key) const;
+	std::string get(const std::string& key) const;
+	// the field's bytes in place, valid while the table is
+	util::string_view view(const std::string& key) const;
+	bool exists() const;
+	// the line number in the table, counted from 0
+	size_t row() const;
 
 private:
-	std::shared_ptr<std::string> values_;
-	std::shared_ptr<GcsvHeader> header_;
+	friend class GcsvRowIterator;
+
+	const GcsvTable* table_;
+	size_t row_;
+};
+
+// A flat, open-addressed hash index of one column of a table.  Each of a power
+// of two slots holds the first line with some value, plus one, and collisions
+// probe the following slots; each line also holds the next line with the same
+// value, plus one, so lines sharing a value are found in file order.  0 is
+// empty in both.
+class GcsvIndex {
+public:
+	GcsvIndex();
+	// Indexes the column of every line of the table.
+	void Build(const GcsvTable& table, int column);
+	// Uses an index that's already built, in memory kept alive by the table's source.
+	void Attach(const GcsvTable& table, int column, const unsigned int* slots, size_t slot_count, const unsigned int* next);
+	// the first line holding key, or the table's size if none does
+	size_t find(util::string_view key) const;
+	// the next line after row holding the same value, or the table's size
+	size_t next(size_t row) const;
+	const unsigned int* slots() const;
+	size_t slot_count() const;
+	// the next line for each line
+	const unsigned int* chain() const;
+
+	static unsigned long long Hash(util::string_view key);
+
+private:
+	const GcsvTable* table_;
+	int column_;
+	std::vector<unsigned int> owned_slots_;
+	std::vector<unsigned int> owned_next_;
+	const unsigned int* slots_;
+	size_t slot_count_;
+	const unsigned int* next_;
+};
+
+// The lines GcsvTable::lookup found, in file order.  The key must outlive it.
+class GcsvMatches {
+public:
+	GcsvMatches(const GcsvTable* table, const GcsvIndex* index, int column, util::string_view key);
+	// Sets row to the next line that matches and returns true, or returns false when there are no more.
+	bool next(GcsvRow& row);
+
+private:
+	const GcsvTable* table_;
+	const GcsvIndex* index_;
+	int column_;
+	util::string_view key_;
+	size_t next_;
+};
+
+class GcsvRowIterator {
+public:
+	typedef std::forward_iterator_tag iterator_category;
+	typedef GcsvRow value_type;
+	typedef std::ptrdiff_t difference_type;
+	typedef const GcsvRow* pointer;
+	typedef const GcsvRow& reference;
+
+	GcsvRowIterator(const GcsvTable* table, size_t row);
+	reference operator*() const;
+	pointer operator->() const;
+	GcsvRowIterator& operator++();
+	GcsvRowIterator operator++(int);
+	bool operator==(const GcsvRowIterator& other) const;
+	bool operator!=(const GcsvRowIterator& other) const;
+
+private:
+	GcsvRow row_;
 };
-typedef std::shared_ptr<GcsvLine> GcsvLinePtr;
 
 
-// GcsvTable has a vector of GcsvLines.  If you had a single gcsv in a file, reading the file would yield a single GcsvTable.
-// The table has a header, which all of the lines will point to.  The lines do NOT contain a reference to the GcsvTable they are in.
-// The table can go out of scope and be cleaned up, even if some lines are still referenced in user code.
+// GcsvTable holds the lines of one gcsv.  If you had a single gcsv in a file, reading the file would yield a single GcsvTable.
+// Each column is kept as the offset and length of its field on every line, into
+// the source the table was read from, so no field is copied or allocated.
 //
-// The table has a mapping of keys to lines -- the keys are the first field in each line.
+// The table has a hash index of keys to lines -- the keys are the first field in each line.
 // So if I read the following GCSV:
 // ~test_name,row_name,col1,col2
 // row1,r1c1,r1c2
 // row2,r2c1,r2c2
-//  the mapping_key will be "row_name", and if I say mytable["row1"] I will get the GcsvLine for row 1.
+//  the mapping_key will be "row_name", and if I say mytable["row1"] I will get the row for row 1.
+// If a key appears more than once, the first line with it wins.
+// Other columns can be indexed too, with AddIndex, and looked up with lookup.
 class GcsvTable {
 public:
-	GcsvTable(std::shared_ptr<GcsvHeader> header);
+	typedef GcsvRowIterator iterator;
+
+	GcsvTable(std::shared_ptr<GcsvHeader> header, GcsvSourcePtr source, gcsv::FieldMode fields = gcsv::kEagerFields);
+	// A table whose cells and key index are already built, in memory the source
+	// keeps alive, as they are in a sidecar.
+	GcsvTable(std::shared_ptr<GcsvHeader> header, GcsvSourcePtr source, size_t rows,
+		const std::vector<const GcsvCell*>& columns, const unsigned int* key_slots, size_t key_slot_count,
+		const unsigned int* key_chain);
 	~GcsvTable();
-	void Add(GcsvLinePtr line);
-	bool ContainsKey(const std::string& key);
-	GcsvLinePtr operator[](const std::string& key);
-	GcsvLinePtr get(const std::string& key);
-	std::string name();
-	std::vector<GcsvLinePtr>::iterator begin();
-	std::vector<GcsvLinePtr>::iterator end();
-	std::shared_ptr<GcsvHeader> header();
+	// Adds a line.  The fields must point into the table's source; missing fields
+	// are empty and fields past the end of the header are dropped.
+	void Add(const std::vector<util::string_view>& fields);
+	// Adds a whole line to a lazy table, which splits it when it is first read.
+	void AddLine(util::string_view line);
+	// Indexes the lines by key.  Called once every line has been added.
+	void Finish();
+	// Indexes the column, so that lookup finds its values without going through
+	// every line.  Call it before the table is shared between threads; a column
+	// that is already indexed, or doesn't exist, is left alone.  The key column
+	// always has an index, so it never needs one added.
+	void AddIndex(const std::string& column);
+	// Every line whose column holds key, through the column's index if it has one.
+	GcsvMatches lookup(const std::string& column, util::string_view key) const;
+	bool ContainsKey(const std::string& key) const;
+	GcsvRow operator[](const std::string& key) const;
+	GcsvRow get(const std::string& key) const;
+	std::string name() const;
+	size_t size() const;
+	iterator begin() const;
+	iterator end() const;
+	std::shared_ptr<GcsvHeader> header() const;
+	util::string_view field(size_t row, int column) const;
+	GcsvSourcePtr source() const;
+	// the column's cells, one per line; a lazy table splits every line first
+	const GcsvCell* column(int column) const;
+	const GcsvIndex& key_index() const;
 
 private:
-	// the mapping_key is the column used for creating the lines_map.  
-	std::string mapping_key_;
+	// fills in the cells of a lazy table's line
+	void Split(size_t row) const;
+
 	std::string name_;
 	std::shared_ptr<GcsvHeader> header_;
-	std::map<std::string, GcsvLinePtr> lines_map_;
-	std::vector<GcsvLinePtr> lines_;
+	GcsvSourcePtr source_;
+	size_t rows_;
+	// filled while reading text; a table loaded from a sidecar leaves them empty.
+	// A lazy table fills all but the key column as its lines are split.
+	mutable std::vector<std::vector<GcsvCell>> columns_;
+	// where the cells are, in the vectors above or in a mapped sidecar
+	mutable std::vector<const GcsvCell*> column_cells_;
+	GcsvIndex keys_;
+	// by column
+	std::map<int, std::shared_ptr<GcsvIndex>> indexes_;
+	// a lazy table's lines, and which of them have been split
+	bool lazy_;
+	std::vector<GcsvCell> lines_;
+	mutable std::vector<char> split_;
 };
 typedef std::shared_ptr<GcsvTable> GcsvTablePtr;
 
+// Decodes the lines of a table straight into structs.  Each column is looked up
+// in the header once, when it is bound, so decoding a line does no lookups and
+// copies nothing but the struct's own strings; numbers are converted here, once,
+// rather than wherever they're used.  A binding made from a header alone decodes
+// the fields of lines handed to a GcsvVisitor.
+//   GcsvBinding<Teleport> binding(*locations);
+//   binding.field("name", &Teleport::Location).field("x", &Teleport::Coords, &Coordinates::x);
+//   binding.decode(row, teleport);
+// A column the table doesn't have leaves its field as it was.
+template <typename T>
+class GcsvBinding {
+public:
+	typedef std::function<void(util::string_view, T&)> Decoder;
+
+	explicit GcsvBinding(const GcsvTable& table) : table_(&table), header_(*table.header()) {}
+	explicit GcsvBinding(const GcsvHeader& header) : table_(NULL), header_(header) {}
+
+	GcsvBinding& field(const std::string& column, std::string T::*member) {
+		return add(column, [member](util::string_view text, T& out) {
+			(out.*member).assign(text.data(), text.size());
+		});
+	}
+	GcsvBinding& field(const std::string& column, double T::*member) {
+		return add(column, [member](util::string_view text, T& out) {
+			out.*member = util::to_double(text);
+		});
+	}
+	// a number in a struct inside T, such as Teleport::Coords.x
+	template <typename M>
+	GcsvBinding& field(const std::string& column, M T::*member, double M::*number) {
+		return add(column, [member, number](util::string_view text, T& out) {
+			(out.*member).*number = util::to_double(text);
+		});
+	}
+
+	void decode(size_t row, T& out) const {
+		assert(table_);
+		for(size_t i = 0; i < decoders_.size(); i++)
+			decoders_[i].second(table_->field(row, decoders_[i].first), out);
+	}
+	// a line's fields, as a GcsvVisitor gets them; missing fields are empty
+	void decode(const std::vector<util::string_view>& fields, T& out) const {
+		for(size_t i = 0; i < decoders_.size(); i++) {
+			size_t column = decoders_[i].first;
+			decoders_[i].second(column < fields.size() ? fields[column] : util::string_view("", 0), out);
+		}
+	}
+
+private:
+	GcsvBinding& add(const std::string& column, Decoder decoder) {
+		int index = header_[column];
+		if(index >= 0)
+			decoders_.push_back(std::make_pair(index, decoder));
+		return *this;
+	}
+
+	const GcsvTable* table_;
+	const GcsvHeader& header_;
+	std::vector<std::pair<int, Decoder>> decoders_;
+};
+
 // A GcsvTableCollection is a table of GcsvTables.  This is what you get
 // after reading a gcsv file, since one file may have several GcsvTables in it.
 // Tables can be accessed by name using the [] operator.
 class GcsvTableCollection {
 public:
-	GcsvTableCollection(); 
+	GcsvTableCollection();
 	~GcsvTableCollection();
 	std::shared_ptr<GcsvTable> operator[](const std::string& key);
 	std::shared_ptr<GcsvTable> get(const std::string& key);
 	void AddTable(std::shared_ptr<GcsvTable> table);
+	// true if the tables came from a sidecar rather than the text
+	bool compiled() const;
 private:
+	friend class GcsvSidecar;
+
 	std::map<std::string, std::shared_ptr<GcsvTable>> tables_;
+	bool compiled_;
 };
-typedef std::shared_ptr<GcsvTableCollection> GcsvTableCollectionPtr;
\ No newline at end of file
+typedef std::shared_ptr<GcsvTableCollection> GcsvTableCollectionPtr;
@@ -8,15 +8,21 @@
 struct WorldData {
 	
 public:
+	// Only the worlds table is read; any other table in the file is passed over.
 	static std::vector<std::shared_ptr<WorldData>> LoadWorldsFromFile(std::string file) {
-		return WorldData::LoadWorlds(gcsv::read(file)->operator[]("worlds"));
+		WorldsVisitor visitor;
+		gcsv::visit(file, visitor);
+		return visitor.worlds;
 	}
 
 	static std::vector<std::shared_ptr<WorldData>> LoadWorlds(GcsvTablePtr table) {
 		std::vector<std::shared_ptr<WorldData>> worlds;
+		GcsvBinding<WorldData> binding(*table);
+		binding.field("name", &WorldData::name_).field("path", &WorldData::path_);
 	
-		BOOST_FOREACH(auto line, std::make_pair(table->begin(), table->end())){	
-			std::shared_ptr<WorldData> world(new WorldData(line->get("name"), line->get("path")));
+		for(size_t row = 0; row < table->size(); row++) {
+			std::shared_ptr<WorldData> world(new WorldData());
+			binding.decode(row, *world);
 			worlds.push_back(world);
 		}
 
@@ -35,6 +41,37 @@ public:
 	}
 
 private:
+	// Decodes the lines of the worlds table as they are read, and stops after it.
+	class WorldsVisitor : public GcsvVisitor {
+	public:
+		gcsv::VisitResult StartTable(util::string_view name) {
+			return name == "worlds" ? gcsv::kContinue : gcsv::kSkipTable;
+		}
+		gcsv::VisitResult Header(GcsvHeaderPtr header) {
+			header_ = header;
+			binding_.reset(new GcsvBinding<WorldData>(*header_));
+			binding_->field("name", &WorldData::name_).field("path", &WorldData::path_);
+			return gcsv::kContinue;
+		}
+		gcsv::VisitResult Row(const std::vector<util::string_view>& fields) {
+			std::shared_ptr<WorldData> world(new WorldData());
+			binding_->decode(fields, *world);
+			worlds.push_back(world);
+			return gcsv::kContinue;
+		}
+		gcsv::VisitResult EndTable() {
+			return binding_ ? gcsv::kStop : gcsv::kContinue;
+		}
+
+		std::vector<std::shared_ptr<WorldData>> worlds;
+
+	private:
+		GcsvHeaderPtr header_;
+		std::unique_ptr<GcsvBinding<WorldData>> binding_;
+	};
+
+	WorldData() {}
+
 	std::string name_;
 	std::string path_;
 };
\ No newline at end of file
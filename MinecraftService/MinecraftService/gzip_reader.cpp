@@ -0,0 +1,314 @@
+#include "stdafx.h"
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+#include "gzip_reader.h"
+
+// The inflate implementation follows the structure of Mark Adler's puff.c: canonical
+// huffman codes are decoded one bit at a time, which is plenty fast for player files
+// of a few kilobytes and keeps the decoder small enough to read in one sitting.
+// The CRC32 in the gzip trailer is not checked, since callers usually stop early.
+
+namespace {
+	const unsigned char kGzipMagic1 = 0x1f;
+	const unsigned char kGzipMagic2 = 0x8b;
+	const unsigned char kDeflateMethod = 8;
+
+	// gzip header flags
+	const int kFlagHeaderCrc = 0x02;
+	const int kFlagExtra = 0x04;
+	const int kFlagName = 0x08;
+	const int kFlagComment = 0x10;
+
+	const int kMaxBits = 15;
+
+	const short kLengthBase[29] = {
+		3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+		35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+	const short kLengthExtra[29] = {
+		0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+		3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+	const short kDistanceBase[30] = {
+		1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+		257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+		8193, 12289, 16385, 24577 };
+	const short kDistanceExtra[30] = {
+		0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+		7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+	// order in which code length code lengths are stored in a dynamic block header
+	const short kCodeLengthOrder[19] = {
+		16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+}
+
+GzipReader::GzipReader(const std::string& path)
+	: in_pos_(0), bit_buffer_(0), bit_count_(0), out_pos_(0),
+	state_(kBlockStart), last_block_(false), stored_remaining_(0) {
+
+	std::ifstream file(path.c_str(), std::ios::in | std::ios::binary);
+	if(!file.is_open())
+		throw std::runtime_error("failed to open file");
+	in_.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+
+	ReadHeader();
+}
+
+void GzipReader::ReadHeader() {
+	if(in_.size() < 18 || in_[0] != kGzipMagic1 || in_[1] != kGzipMagic2) {
+		// not gzipped, so the file contents are the stream contents
+		out_.swap(in_);
+		state_ = kRaw;
+		return;
+	}
+	if(in_[2] != kDeflateMethod)
+		throw std::runtime_error("unsupported gzip compression method");
+
+	int flags = in_[3];
+	in_pos_ = 10; // magic, method, flags, mtime, extra flags, os
+
+	if(flags & kFlagExtra) {
+		size_t extra_length = in_[in_pos_] | (in_[in_pos_ + 1] << 8);
+		in_pos_ += 2 + extra_length;
+	}
+	if(flags & kFlagName) {
+		while(in_pos_ < in_.size() && in_[in_pos_] != 0)
+			in_pos_++;
+		in_pos_++;
+	}
+	if(flags & kFlagComment) {
+		while(in_pos_ < in_.size() && in_[in_pos_] != 0)
+			in_pos_++;
+		in_pos_++;
+	}
+	if(flags & kFlagHeaderCrc)
+		in_pos_ += 2;
+
+	if(in_pos_ >= in_.size())
+		throw std::runtime_error("truncated gzip header");
+
+	// player files typically inflate to several times their compressed size
+	out_.reserve(in_.size() * 4);
+}
+
+bool GzipReader::read(void* dest, size_t count) {
+	if(count == 0)
+		return true;
+	if(!Fill(count))
+		return false;
+	std::memcpy(dest, &out_[out_pos_], count);
+	out_pos_ += count;
+	return true;
+}
+
+bool GzipReader::skip(size_t count) {
+	if(!Fill(count))
+		return false;
+	out_pos_ += count;
+	return true;
+}
+
+// Inflates until at least `needed` bytes of output exist past the read position,
+// or the stream ends.  Compared by subtracting, so no count can wrap around.
+bool GzipReader::Fill(size_t needed) {
+	while(out_.size() - out_pos_ < needed && state_ != kDone && state_ != kRaw)
+		Step();
+	return out_.size() - out_pos_ >= needed;
+}
+
+// Advances the decoder by one unit of work: a block header, a whole stored block, or one symbol.
+void GzipReader::Step() {
+	switch(state_) {
+	case kBlockStart:
+		if(last_block_)
+			state_ = kDone;
+		else
+			StartBlock();
+		break;
+	case kStored:
+		if(in_pos_ + stored_remaining_ > in_.size())
+			throw std::runtime_error("truncated stored block");
+		out_.insert(out_.end(), in_.begin() + in_pos_, in_.begin() + in_pos_ + stored_remaining_);
+		in_pos_ += stored_remaining_;
+		stored_remaining_ = 0;
+		state_ = kBlockStart;
+		break;
+	case kCodes:
+		DecodeSymbol();
+		break;
+	default:
+		break;
+	}
+}
+
+void GzipReader::StartBlock() {
+	last_block_ = Bits(1) == 1;
+	int type = Bits(2);
+	if(type == 0) {
+		// stored blocks start on a byte boundary
+		bit_buffer_ = 0;
+		bit_count_ = 0;
+		if(in_pos_ + 4 > in_.size())
+			throw std::runtime_error("truncated stored block");
+		size_t length = in_[in_pos_] | (in_[in_pos_ + 1] << 8);
+		size_t complement = in_[in_pos_ + 2] | (in_[in_pos_ + 3] << 8);
+		if(length != (~complement & 0xffff))
+			throw std::runtime_error("corrupt stored block length");
+		in_pos_ += 4;
+		stored_remaining_ = length;
+		state_ = kStored;
+	}
+	else if(type == 1) {
+		BuildFixedTables();
+		state_ = kCodes;
+	}
+	else if(type == 2) {
+		BuildDynamicTables();
+		state_ = kCodes;
+	}
+	else {
+		throw std::runtime_error("invalid deflate block type");
+	}
+}
+
+void GzipReader::DecodeSymbol() {
+	int symbol = Decode(lengths_);
+	if(symbol < 256) {
+		out_.push_back(static_cast<unsigned char>(symbol));
+		return;
+	}
+	if(symbol == 256) {
+		state_ = kBlockStart;
+		return;
+	}
+
+	symbol -= 257;
+	if(symbol >= 29)
+		throw std::runtime_error("invalid deflate length symbol");
+	size_t length = kLengthBase[symbol] + Bits(kLengthExtra[symbol]);
+
+	int distance_symbol = Decode(distances_);
+	if(distance_symbol >= 30)
+		throw std::runtime_error("invalid deflate distance symbol");
+	size_t distance = kDistanceBase[distance_symbol] + Bits(kDistanceExtra[distance_symbol]);
+	if(distance > out_.size())
+		throw std::runtime_error("deflate distance too far back");
+
+	// the copy may overlap the bytes it is producing, so it goes one byte at a time
+	size_t from = out_.size() - distance;
+	for(size_t i = 0; i < length; i++) {
+		unsigned char c = out_[from + i];
+		out_.push_back(c);
+	}
+}
+
+void GzipReader::BuildFixedTables() {
+	short lengths[288];
+	int symbol = 0;
+	for(; symbol < 144; symbol++) lengths[symbol] = 8;
+	for(; symbol < 256; symbol++) lengths[symbol] = 9;
+	for(; symbol < 280; symbol++) lengths[symbol] = 7;
+	for(; symbol < 288; symbol++) lengths[symbol] = 8;
+	Construct(lengths_, lengths, 288);
+
+	for(symbol = 0; symbol < 30; symbol++) lengths[symbol] = 5;
+	Construct(distances_, lengths, 30);
+}
+
+void GzipReader::BuildDynamicTables() {
+	int literal_count = Bits(5) + 257;
+	int distance_count = Bits(5) + 1;
+	int code_count = Bits(4) + 4;
+	if(literal_count > 286 || distance_count > 30)
+		throw std::runtime_error("corrupt dynamic block header");
+
+	short lengths[286 + 30];
+	int index = 0;
+	for(; index < code_count; index++)
+		lengths[kCodeLengthOrder[index]] = static_cast<short>(Bits(3));
+	for(; index < 19; index++)
+		lengths[kCodeLengthOrder[index]] = 0;
+
+	Huffman code_lengths;
+	Construct(code_lengths, lengths, 19);
+
+	index = 0;
+	while(index < literal_count + distance_count) {
+		int symbol = Decode(code_lengths);
+		if(symbol < 16) {
+			lengths[index++] = static_cast<short>(symbol);
+			continue;
+		}
+		short repeated = 0;
+		int repeat;
+		if(symbol == 16) {
+			if(index == 0)
+				throw std::runtime_error("repeat with no previous length");
+			repeated = lengths[index - 1];
+			repeat = 3 + Bits(2);
+		}
+		else if(symbol == 17) {
+			repeat = 3 + Bits(3);
+		}
+		else {
+			repeat = 11 + Bits(7);
+		}
+		if(index + repeat > literal_count + distance_count)
+			throw std::runtime_error("too many code lengths");
+		while(repeat--)
+			lengths[index++] = repeated;
+	}
+
+	Construct(lengths_, lengths, literal_count);
+	Construct(distances_, lengths + literal_count, distance_count);
+}
+
+int GzipReader::Bits(int count) {
+	while(bit_count_ < count) {
+		if(in_pos_ >= in_.size())
+			throw std::runtime_error("unexpected end of deflate stream");
+		bit_buffer_ |= static_cast<unsigned long>(in_[in_pos_++]) << bit_count_;
+		bit_count_ += 8;
+	}
+	int value = static_cast<int>(bit_buffer_ & ((1UL << count) - 1));
+	bit_buffer_ >>= count;
+	bit_count_ -= count;
+	return value;
+}
+
+// Reads a code one bit at a time.  Codes of each length are consecutive integers,
+// so we only need to know where each length starts to find the symbol.
+int GzipReader::Decode(const Huffman& table) {
+	int code = 0;
+	int first = 0;
+	int index = 0;
+	for(int length = 1; length <= kMaxBits; length++) {
+		code |= Bits(1);
+		int count = table.counts[length];
+		if(code - count < first)
+			return table.symbols[index + (code - first)];
+		index += count;
+		first += count;
+		first <<= 1;
+		code <<= 1;
+	}
+	throw std::runtime_error("invalid huffman code");
+}
+
+void GzipReader::Construct(Huffman& table, const short* lengths, int count) {
+	for(int length = 0; length <= kMaxBits; length++)
+		table.counts[length] = 0;
+	for(int symbol = 0; symbol < count; symbol++)
+		table.counts[lengths[symbol]]++;
+
+	short offsets[kMaxBits + 1];
+	offsets[1] = 0;
+	for(int length = 1; length < kMaxBits; length++)
+		offsets[length + 1] = offsets[length] + table.counts[length];
+
+	for(int symbol = 0; symbol < count; symbol++) {
+		if(lengths[symbol] != 0)
+			table.symbols[offsets[lengths[symbol]]++] = static_cast<short>(symbol);
+	}
+}
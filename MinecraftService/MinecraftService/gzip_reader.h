@@ -0,0 +1,61 @@
+#pragma once
+
+#include "stdafx.h"
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+// GzipReader is a read-only, pull-based gzip (RFC 1952 / RFC 1951) decoder.
+// The compressed file is loaded into memory, but it is only inflated as far as
+// the caller has actually read, so a caller that finds what it needs near the
+// start of the stream never pays for decoding the rest of it.
+//
+// Files without the gzip magic number are passed through unchanged.
+class GzipReader {
+public:
+	GzipReader(const std::string& path);
+
+	// Copies the next count bytes into dest.  Returns false if the stream ends first.
+	bool read(void* dest, size_t count);
+
+	// Discards the next count bytes.  Returns false if the stream ends first.
+	bool skip(size_t count);
+
+	// Number of decompressed bytes produced so far.
+	size_t inflated_size() const { return out_.size(); }
+
+private:
+	enum State { kBlockStart, kStored, kCodes, kDone, kRaw };
+
+	// canonical huffman table: number of codes of each length, and symbols ordered by code
+	struct Huffman {
+		short counts[16];
+		short symbols[288];
+	};
+
+	void ReadHeader();
+	bool Fill(size_t needed);  // bytes past out_pos_
+	void Step();
+	void StartBlock();
+	void DecodeSymbol();
+	void BuildFixedTables();
+	void BuildDynamicTables();
+
+	int Bits(int count);
+	int Decode(const Huffman& table);
+	static void Construct(Huffman& table, const short* lengths, int count);
+
+	std::vector<unsigned char> in_;
+	size_t in_pos_;
+	unsigned long bit_buffer_;
+	int bit_count_;
+
+	std::vector<unsigned char> out_;
+	size_t out_pos_;
+
+	State state_;
+	bool last_block_;
+	size_t stored_remaining_;
+	Huffman lengths_;
+	Huffman distances_;
+};
@@ -1,21 +1,22 @@
-
-
 #include "stdafx.h"
 #include <cstdlib>
+#include <iostream>
 #include <map>
+#include <sstream>
 #include <vector>
+#include <assert.h>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/function.hpp>
 
+#include "io_helpers.h"
+#include "../../shared/string_view.hpp"
 
-namespace io_helpers {
+namespace {
 
-	// Converts: 
-	// "a,b,c"   --> ["a", "b", "c"]
-	// "a,b,c,"  --> ["a", "b", "c"]
-	// "a,,b,c," --> ["a", "", "b", "c"]
-	// ","       --> []
-	// ""        --> []
-	std::vector<std::string> tokenize(std::string text, char delimiter) {
-		
+	// The tokenizer as it was before util::splitter, kept to benchmark against.
+	// It copies the rest of the text after every field.
+	std::vector<std::string> tokenize_by_substr(std::string text, char delimiter) {
 		std::vector<std::string> split;
 
 		int index = text.find_first_of(delimiter);
@@ -27,7 +28,173 @@ namespace io_helpers {
 
 		if(text.length() > 0)
 			split.push_back(text);
-		
+
+		return split;
+	}
+
+	// The file reader as it was before for_each_line, kept to benchmark against.
+	// It cuts lines off at 1023 characters and copies each one twice.
+	void iterate_file_by_getline(boost::function<void(std::string)> func, std::string path) {
+		std::ifstream myfile(path);
+		const int buffer_length = 1024;
+		char buffer[buffer_length];
+		if(myfile.is_open()) {
+			while(myfile.good()) {
+				myfile.getline(buffer, buffer_length);
+				std::string str(buffer);
+				std::string trimmed = io_helpers::trim(str);
+				if(io_helpers::is_valid_line(trimmed))
+					func(trimmed);
+			}
+			myfile.close();
+		}
+		else {
+			throw std::exception("failed to open file");
+		}
+	}
+
+	// gathers the lines for_each_line finds
+	struct LineCollector {
+		LineCollector(std::vector<std::string>& lines) : lines_(lines) {}
+		bool operator()(util::string_view line) {
+			lines_.push_back(line.str());
+			return true;
+		}
+		std::vector<std::string>& lines_;
+	};
+}
+
+namespace io_helpers {
+
+	// Converts: 
+	// "a,b,c"   --> ["a", "b", "c"]
+	// "a,b,c,"  --> ["a", "b", "c"]
+	// "a,,b,c," --> ["a", "", "b", "c"]
+	// ","       --> [""]
+	// ""        --> []
+	std::vector<std::string> tokenize(const std::string& text, char delimiter) {
+		std::vector<std::string> split;
+		util::splitter fields(text, delimiter);
+		util::string_view field;
+		while(fields.next(field))
+			split.push_back(field.str());
 		return split;
 	}
+
+	void test_tokenize() {
+		std::cout << "testing tokenize..." << std::endl;
+		const char* cases[] = { "a,b,c", "a,b,c,", "a,,b,c,", ",", "", "abc", ",a", "a,,," };
+		std::vector<util::string_view> fields;
+		BOOST_FOREACH(const char* text, cases) {
+			auto expected = tokenize_by_substr(text, ',');
+			assert(tokenize(text, ',') == expected);
+			util::split(text, ',', fields);
+			assert(fields.size() == expected.size());
+			for(size_t i = 0; i < fields.size(); i++)
+				assert(fields[i].str() == expected[i]);
+		}
+		assert(util::to_double(util::string_view("-123.5,64", 6)) == -123.5);
+		std::cout << "finished testing tokenize" << std::endl;
+	}
+
+	void test_line_reader() {
+		std::cout << "testing line reader..." << std::endl;
+		const std::string path = "test_line_reader.txt";
+		std::string long_line(3000, 'x');
+		{
+			std::ofstream file(path.c_str(), std::ios::binary);
+			file << "  first \r\n// comment\n\n\t\r\n" << long_line << "\nsecond\t\n/also a comment\nlast";
+		}
+		const char* expected[] = { "first", long_line.c_str(), "second", "last" };
+		// blocks smaller than a line, one the size of the file, and the usual size
+		const size_t block_sizes[] = { 1, 7, 3050, kReadBlockSize };
+		BOOST_FOREACH(size_t block_size, block_sizes) {
+			std::vector<std::string> lines;
+			assert(for_each_line(path, LineCollector(lines), block_size));
+			assert(lines.size() == 4);
+			for(size_t i = 0; i < lines.size(); i++)
+				assert(lines[i] == expected[i]);
+		}
+
+		// returning false stops the reading
+		int seen = 0;
+		assert(!for_each_line(path, [&seen](util::string_view line) { return ++seen < 2; }, 5));
+		assert(seen == 2);
+		boost::filesystem::remove(path);
+
+		bool threw = false;
+		try {
+			for_each_line("no_such_file.txt", [](util::string_view) { return true; });
+		}
+		catch(std::exception&) {
+			threw = true;
+		}
+		assert(threw);
+		std::cout << "finished testing line reader" << std::endl;
+	}
+
+	void benchmark_line_reader(int lines) {
+		using boost::posix_time::microsec_clock;
+		std::cout << "benchmarking line reader..." << std::endl;
+		const std::string path = "benchmark_line_reader.txt";
+		{
+			std::ofstream file(path.c_str());
+			for(int i = 0; i < lines; i++)
+				file << "  loc" << i << "," << (i % 50) * 10 - 123 << ",64," << (i / 50) * 10 + 250 << std::endl;
+		}
+
+		size_t total = 0;
+		auto start = microsec_clock::universal_time();
+		iterate_file_by_getline([&total](std::string line) { total += line.size(); }, path);
+		double getline_ms = (microsec_clock::universal_time() - start).total_microseconds() / 1e3;
+
+		start = microsec_clock::universal_time();
+		for_each_line(path, [&total](util::string_view line) -> bool {
+			total += line.size();
+			return true;
+		});
+		double block_ms = (microsec_clock::universal_time() - start).total_microseconds() / 1e3;
+
+		std::cout << lines << " lines: " << getline_ms << " ms with getline, "
+			<< block_ms << " ms a block at a time (" << total << ")" << std::endl;
+		boost::filesystem::remove(path);
+	}
+
+	void benchmark_tokenize(int count) {
+		using boost::posix_time::microsec_clock;
+		std::cout << "benchmarking tokenize..." << std::endl;
+
+		// a get_teleports_response for a player near twelve teleports in each of eight worlds
+		std::stringstream line;
+		line << "get_teleports_response,PhilipM,";
+		for(int world = 0; world < 8; world++) {
+			for(int teleport = 0; teleport < 12; teleport++)
+				line << "world" << world << ":spawn:tower" << teleport << "|";
+		}
+		std::string text = line.str();
+
+		size_t total = 0;
+		auto start = microsec_clock::universal_time();
+		for(int i = 0; i < count; i++)
+			total += tokenize_by_substr(text, '|').size();
+		double substr_seconds = (microsec_clock::universal_time() - start).total_microseconds() / 1e6;
+
+		start = microsec_clock::universal_time();
+		for(int i = 0; i < count; i++)
+			total += tokenize(text, '|').size();
+		double tokenize_seconds = (microsec_clock::universal_time() - start).total_microseconds() / 1e6;
+
+		std::vector<util::string_view> fields;
+		start = microsec_clock::universal_time();
+		for(int i = 0; i < count; i++) {
+			util::split(text, '|', fields);
+			total += fields.size();
+		}
+		double split_seconds = (microsec_clock::universal_time() - start).total_microseconds() / 1e6;
+
+		std::cout << "substr tokenize:    " << count / substr_seconds << " lines/sec" << std::endl;
+		std::cout << "tokenize to string: " << count / tokenize_seconds << " lines/sec" << std::endl;
+		std::cout << "split to views:     " << count / split_seconds << " lines/sec" << std::endl;
+		std::cout << "(" << total << " fields)" << std::endl;
+	}
 }
@@ -9,9 +9,10 @@
 #include <set>
 #include <map>
 #include <boost/enable_shared_from_this.hpp>
-#include <boost/function.hpp>
+#include <cstring>
 #include <fstream>
 #include <vector>
+#include "../../shared/string_view.hpp"
 
 typedef std::vector<std::string> vector_str;
 
@@ -20,7 +21,21 @@ namespace io_helpers {
 	const std::string comment = "//";
 	const std::string whitespace_chars = " \t";
 
-	vector_str tokenize(std::string str, char delimiter);
+	// copies each field util::splitter finds into a string
+	vector_str tokenize(const std::string& text, char delimiter);
+
+	void test_tokenize();
+
+	// Compares the old substr tokenizer, tokenize, and util::split on the protocol's longest lines.
+	void benchmark_tokenize(int count);
+
+	void test_line_reader();
+
+	// Compares reading a file with getline, as iterate_file used to, against for_each_line.
+	void benchmark_line_reader(int lines);
+
+	// how much of a file for_each_line reads at a time
+	const size_t kReadBlockSize = 64 * 1024;
 
 	// returns true if the line does not begin with a comment.
 	inline bool is_valid_line(const std::string& str) {
@@ -43,22 +58,68 @@ namespace io_helpers {
 		return str.substr(strBegin, strRange);
 	}
 
-	inline void iterate_file(boost::function<void(std::string)> func, std::string path) {
-		std::ifstream myfile(path);
-		const int buffer_length = 1024;
-		char buffer[buffer_length];
-		if(myfile.is_open()) {
-			while(myfile.good()) {
-				myfile.getline(buffer, buffer_length);
-				std::string str(buffer);
-				std::string trimmed = trim(str);
-				if(is_valid_line(trimmed))
-					func(trimmed);
-			}
-			myfile.close();
+	// Strips the spaces and tabs trim does, and the '\r' of a Windows line ending.
+	inline util::string_view trim_line(util::string_view line) {
+		const char* begin = line.begin();
+		const char* end = line.end();
+		while(begin != end && (*begin == ' ' || *begin == '\t'))
+			++begin;
+		while(end != begin && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r'))
+			--end;
+		return util::string_view(begin, end - begin);
+	}
+
+	// the same test as is_valid_line above
+	inline bool is_valid_line(util::string_view line) {
+		return !line.empty() && line[0] != comment[0];
+	}
+
+	// Hands func every trimmed, valid line from begin to end as a view into the
+	// text, for as long as func returns true.  A last line needn't end in a
+	// newline.  The lines are found with memchr, which the C library vectorizes.
+	// Returns false if func stopped it.
+	template <typename LineHandler>
+	bool for_each_line(const char* begin, const char* end, LineHandler func) {
+		const char* next = begin;
+		while(next < end) {
+			const char* newline = static_cast<const char*>(std::memchr(next, '\n', end - next));
+			const char* line_end = newline ? newline : end;
+			util::string_view line = trim_line(util::string_view(next, line_end - next));
+			if(is_valid_line(line) && !func(line))
+				return false;
+			next = line_end + 1;
 		}
-		else {
+		return true;
+	}
+
+	// The same for a file, read a block at a time.  A line may be any length: one
+	// that runs past the end of a block is kept for the next, and the block grows
+	// if a line won't fit in it.  Each view is only valid during its call.
+	// Throws if the file can't be opened.
+	template <typename LineHandler>
+	bool for_each_line(const std::string& path, LineHandler func, size_t block_size = kReadBlockSize) {
+		std::ifstream file(path.c_str(), std::ios::binary);
+		if(!file.is_open())
 			throw std::exception("failed to open file");
+		std::vector<char> block((std::max)(block_size, static_cast<size_t>(1)));
+		// the start of a line the last block ended part way through
+		size_t kept = 0;
+		while(file) {
+			if(kept == block.size())
+				block.resize(block.size() * 2);
+			file.read(&block[kept], block.size() - kept);
+			const char* begin = &block[0];
+			const char* end = begin + kept + static_cast<size_t>(file.gcount());
+			if(!file)
+				return for_each_line(begin, end, func);
+			const char* last_line = end;
+			while(last_line != begin && last_line[-1] != '\n')
+				--last_line;
+			if(!for_each_line(begin, last_line, func))
+				return false;
+			kept = end - last_line;
+			std::memmove(&block[0], last_line, kept);
 		}
+		return true;
 	}
 }
\ No newline at end of file
@@ -5,22 +5,31 @@
 
 #include <algorithm>
 #include <cstdlib>
+#include <fstream>
 #include <iostream>
 #include <vector>
 #include <string>
 #include <sstream>
 #include "stdarg.h"
 #include "gcsv.h"
+#include <boost/bind.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
 
 #include "../../shared/minecraft_shared.hpp"
 #include "io_helpers.h"
 #include "gcsv_worlds.h"
+#include "player_cache.h"
+#include "worldswitch_worker.h"
+#include "teleport_index.h"
+#include "file_cache.h"
 
 typedef std::string str;
 typedef std::vector<std::pair<std::string,std::string>> vector_pair;
+typedef std::vector<std::shared_ptr<WorldData>> WorldList;
 
-// the below three files will be in the same directory as this executable
+// the below three files will be in the same directory as this executable.
+// WorldSwitch.exe is started once and kept running as a worker (see worldswitch_worker.h)
 const std::string kExecutable = "WorldSwitch.exe";
 const std::string kIniFile = "worldswitch.ini";
 const std::string kWorldsFile = "worlds.csv"; 
@@ -34,6 +43,12 @@ const std::string kTeleportsFile = "teleports.csv";
 
 const double kCloseEnoughToTeleportFrom = 20;
 
+// how long each command may take before the client is told it timed out
+const boost::posix_time::time_duration kWorldSwitchTimeout = boost::posix_time::seconds(30);
+const boost::posix_time::time_duration kTeleportTimeout = boost::posix_time::seconds(15);
+const boost::posix_time::time_duration kMenuTimeout = boost::posix_time::seconds(5);
+const boost::posix_time::time_duration kDefaultTimeout = boost::posix_time::seconds(2);
+
 
 // Packs variable number of arguments into std::deque.
 std::deque<std::string> list( int Count, ... )
@@ -47,102 +62,119 @@ std::deque<std::string> list( int Count, ... )
 	return list;
 }
 
-// Returns the beginning of a WorldSwitch command, with the exe and ini file specified.
-const std::stringstream begin_command() {
-	std::stringstream stream;
-	stream << kExecutable << " " << kIniFile << " ";
-	return stream;
+// generates a response to send back to the client
+MinecraftMessage ResponseCommand(std::string command, std::string player, std::deque<std::string> params) {
+	return MinecraftMessage(command, player, params);
 }
 
-// Returns a full WorldSwitch command, with the exe, ini file, 
-// command and parameters ready to be sent to the system call.
-std::string make_command(std::string command, std::deque<std::string> params) {
-	auto stream = begin_command();
-	stream << command << " ";
-	foreach(param, params) {
-		stream << *param << " ";
-	}
-	return stream.str();
+// Sends a command that changes a player's files to the persistent WorldSwitch worker.
+// Once it is sent the worker will carry it out, so the job commits first and then
+// waits for the worker's answer, up to the worker's hang limit; the client is told
+// what actually happened rather than that the request timed out.  Fails without
+// sending anything if the job's deadline has already passed.
+WorkerResponse InvokeCommand(WorldSwitchWorker& worker, std::string command, std::deque<std::string> params, handler_job_ptr job) {
+	if(!job->commit())
+		return WorkerResponse();
+	return worker.call(command, params);
 }
 
-// generates a response to send back to the client
-std::string ResponseCommand(std::string command, std::string player, std::deque<std::string> params) {
-	params.push_front(player);
-	params.push_front(command);
-	return MinecraftMessage(params).AsMessage();
-}
+// players' positions are only read again when the server writes their player file
+PlayerCache player_cache(kPlayersDirectory, kPlayerFileExtension);
 
-// performs the given system call and returns the first line of output
-std::string system_with_output(std::string command) {
-	FILE* output = _popen(command.c_str(), "r");
-	char buffer[1024];
-	fgets(buffer, sizeof(buffer), output);
-	_pclose(output);
-	return std::string(buffer);
+bool PlayerIsInWorld(std::string world_path, std::string player) {
+	return player_cache.get(world_path, player).exists;
 }
 
-std::string InvokeCommand(std::string command, std::deque<std::string> params) {
-	auto cmd = make_command(command, params);
-	return system_with_output(cmd);
-}
+// worlds.csv and each world's teleports.csv are only parsed again when they change
+FileCache<WorldList> worlds_cache("worlds");
+FileCache<WorldTeleports> teleports_cache("teleports");
 
-std::string GetPlayerFile(std::string world_path, std::string player) {
-	auto path = boost::filesystem::path(world_path);
-	path /= kPlayersDirectory;
-	path /= (player + kPlayerFileExtension);
-	return path.string();
+std::shared_ptr<WorldList> ReadWorlds(const std::string& path) {
+	return std::shared_ptr<WorldList>(new WorldList(WorldData::LoadWorldsFromFile(path)));
 }
 
-bool PlayerIsInWorld(std::string world_path, std::string player) {
-	return boost::filesystem::exists(GetPlayerFile(world_path, player));
+std::shared_ptr<WorldList> LoadWorlds() {
+	return worlds_cache.get(kWorldsFile, &ReadWorlds);
 }
-std::map<std::string, Teleport> LoadTeleports(WorldData world) {
-	auto path = boost::filesystem::path(world.path());
-	auto teleports_path = path/kTeleportsFile;
 
-	std::map<std::string, Teleport> teleports;
+// a line of teleports.csv's teleports table: the names of the two locations it joins
+struct TeleportLine {
+	std::string from;
+	std::string to;
+};
+
+// Reads the world's teleports.csv, indexing the locations by position
+// and the teleports by the location they start from.
+WorldTeleportsPtr ReadTeleports(const std::string& teleports_path, std::string world_name) {
+	WorldTeleportsPtr teleports(new WorldTeleports(kCloseEnoughToTeleportFrom));
 	
 	if(boost::filesystem::exists(teleports_path)) {
-		auto teleports_csv = gcsv::read(teleports_path.string());
+		auto teleports_csv = gcsv::read(teleports_path, gcsv::kUseSidecar);
 		auto locations = teleports_csv->get("locations");
 		auto world_teleports = teleports_csv->get("teleports");
-		for(auto it = locations->begin(); it != locations->end(); ++it) {
-			auto loc = *it;
-			auto name = loc->get("name");
-			auto coords = Coordinates(loc->get("x"),loc->get("y"),loc->get("z"));
-			teleports.insert(std::make_pair(name, Teleport(world.name(), name, coords)));
+		// a file missing either table is treated as having no teleports
+		if(!locations || !world_teleports)
+			return teleports;
+		GcsvBinding<Teleport> location(*locations);
+		location.field("name", &Teleport::Location)
+			.field("x", &Teleport::Coords, &Coordinates::x)
+			.field("y", &Teleport::Coords, &Coordinates::y)
+			.field("z", &Teleport::Coords, &Coordinates::z);
+		// each line's location, the first of any with the same name
+		std::vector<const Teleport*> by_row(locations->size());
+		for(size_t row = 0; row < locations->size(); row++) {
+			Teleport teleport;
+			teleport.World = world_name;
+			location.decode(row, teleport);
+			by_row[row] = &teleports->AddLocation(teleport);
+		}
+		// the teleports name the locations they join; "name" is the locations table's
+		// key column, so lookup finds them through the key index every table has
+		GcsvBinding<TeleportLine> link(*world_teleports);
+		link.field("a", &TeleportLine::from).field("b", &TeleportLine::to);
+		TeleportLine line;
+		GcsvRow from, to;
+		for(size_t row = 0; row < world_teleports->size(); row++) {
+			link.decode(row, line);
+			if(!locations->lookup("name", line.from).next(from) || !locations->lookup("name", line.to).next(to))
+				continue;
+			// nobody is sent to, or offered a way from, a location that isn't a real point
+			if(!IsFinite(by_row[from.row()]->Coords) || !IsFinite(by_row[to.row()]->Coords))
+				continue;
+			const Teleport& loc1 = *by_row[from.row()];
+			teleports->pairs_from.insert(std::make_pair(loc1.Location, teleports->pairs.size()));
+			teleports->pairs.push_back(TeleportPair(world_name, loc1, *by_row[to.row()]));
 		}
 	}
 	return teleports;
 }
 
-Coordinates InvokeGetCoordinates(std::string player, std::string world) {
-	auto coords = InvokeCommand(commands::get_coords, list(2, player, world));
-	return Coordinates(coords);
+WorldTeleportsPtr LoadTeleports(WorldData world) {
+	auto teleports_path = boost::filesystem::path(world.path())/kTeleportsFile;
+	return teleports_cache.get(teleports_path.string(), boost::bind(&ReadTeleports, _1, world.name()));
+}
+
+// Reads the player's position out of their .dat file in the world, or the cache.
+// This only reads the file, unlike WorldSwitch.exe get_coords which saves it back out.
+Coordinates InvokeGetCoordinates(std::string player, WorldData world) {
+	return player_cache.get(world.path(), player).coords;
 }
 
 // Returns true if player is near any teleport location
 bool PlayerIsNearAnyTeleport(std::string player, WorldData world) {
-	auto player_coords = InvokeGetCoordinates(player, world.name());
-	auto locations = LoadTeleports(world);
-	BOOST_FOREACH(auto loc, locations) {
-		if(loc.second.Coords.Within(player_coords, kCloseEnoughToTeleportFrom))
-			return true;
-	}
-	return false;
+	auto player_coords = InvokeGetCoordinates(player, world);
+	auto teleports = LoadTeleports(world);
+	return teleports->index.AnyNear(player_coords, kCloseEnoughToTeleportFrom);
 }
 
 
-// returns all valid pairs of worlds for the player to switch between
-vector_pair GetWorldsToSwitch(std::string player) {
-	auto worlds = WorldData::LoadWorldsFromFile(kWorldsFile);
+// Pairs up every world the player is near a teleport in, in worlds.csv order.
+vector_pair PairWorlds(const WorldList& worlds, const std::vector<char>& valid) {
 	vector_pair pairs;
 	std::vector<str> valid_worlds;
-	
-	BOOST_FOREACH(auto world, worlds)  {
-		if(PlayerIsInWorld(world->path(), player))
-			if(PlayerIsNearAnyTeleport(player, *(world.get())))
-				valid_worlds.push_back(world->name());
+	for(size_t i = 0; i < worlds.size(); i++) {
+		if(valid[i])
+			valid_worlds.push_back(worlds[i]->name());
 	}
 	for(auto it = valid_worlds.begin(); it != valid_worlds.end(); ++it) {
 		for(auto k = it; k != valid_worlds.end(); ++k) {
@@ -154,9 +186,27 @@ vector_pair GetWorldsToSwitch(std::string player) {
 	return pairs;
 }
 
+// returns all valid pairs of worlds for the player to switch between.
+// Each world is checked on the world pool; the pairs come out in worlds.csv order.
+vector_pair CollectWorldsToSwitch(work_pool& world_work, const WorldList& worlds, std::string player, handler_job_ptr job) {
+	// not vector<bool>, whose elements can't be written from different threads
+	std::vector<char> valid(worlds.size(), false);
+
+	world_work.run_all(worlds.size(), [&](size_t i) {
+		if(job->cancelled())
+			return;
+		if(PlayerIsInWorld(worlds[i]->path(), player))
+			valid[i] = PlayerIsNearAnyTeleport(player, *(worlds[i].get()));
+	});
+
+	return PairWorlds(worlds, valid);
+}
+
+vector_pair GetWorldsToSwitch(work_pool& world_work, std::string player, handler_job_ptr job) {
+	return CollectWorldsToSwitch(world_work, *LoadWorlds(), player, job);
+}
 
-std::string GetPackedWorldsToSwitch(std::string player) {
-	auto pairs = GetWorldsToSwitch(player);
+std::string PackWorldsToSwitch(const vector_pair& pairs) {
 	std::stringstream stream;
 	BOOST_FOREACH(auto pair, pairs) {
 		stream << pair.first << minecraft::kDelimiter2 << pair.second;
@@ -167,57 +217,56 @@ std::string GetPackedWorldsToSwitch(std::string player) {
 	return packed_string;
 }
 
-void InvokeWorldSwitch(std::string player, WorldSwitch worldswitch) {
-	auto output = InvokeCommand(commands::worldswitch, list(3, player, worldswitch.World1, worldswitch.World2));
+std::string GetPackedWorldsToSwitch(work_pool& world_work, std::string player, handler_job_ptr job) {
+	return PackWorldsToSwitch(GetWorldsToSwitch(world_work, player, job));
+}
+
+bool InvokeWorldSwitch(WorldSwitchWorker& worker, std::string player, WorldSwitch worldswitch, handler_job_ptr job) {
+	return InvokeCommand(worker, commands::worldswitch, list(3, player, worldswitch.World1, worldswitch.World2), job).success;
 }
 
 // What needs to happen for the player to teleport:
 // client -> get_teleports -> server
 // server:
 //   get worlds
-//   foreach world:
+//   foreach world, on the world pool:
 //     get coordinates
 //     get all teleports
 //	   filter for valid teleports
-//     add to list
-std::vector<TeleportPair> InvokeGetTeleports(std::string player) {
+//   add each world's teleports to the list, in worlds.csv order
+std::vector<TeleportPair> CollectTeleports(work_pool& world_work, const WorldList& worlds, std::string player, handler_job_ptr job) {
+	std::vector<std::vector<TeleportPair>> world_teleports(worlds.size());
 
-	auto worlds = WorldData::LoadWorldsFromFile(kWorldsFile);
+	world_work.run_all(worlds.size(), [&](size_t i) {
+		if(job->cancelled())
+			return;
+		const WorldData& world = *(worlds[i].get());
+		if(!PlayerIsInWorld(world.path(), player))
+			return;
 
-	std::stringstream packed_teleports;
-	std::vector<TeleportPair> teleports;
+		auto player_coords = InvokeGetCoordinates(player, world);
+		world_teleports[i] = LoadTeleports(world)->PairsNear(player_coords, kCloseEnoughToTeleportFrom);
+	});
 
-	BOOST_FOREACH(auto world, worlds) { 
-		if(!PlayerIsInWorld(world->path(), player)) 
-			continue;
-
-		auto world_name = world->name();
-		auto path = boost::filesystem::path(world->path());
-		auto teleports_path = path/kTeleportsFile;
-		auto player_coords = InvokeGetCoordinates(player, world_name);
-		auto locations = LoadTeleports(*(world.get()));
-		if(boost::filesystem::exists(teleports_path)) {
-			auto teleports_csv = gcsv::read(teleports_path.string());
-			auto world_teleports = teleports_csv->get("teleports");
-			for(auto tp = world_teleports->begin(); tp != world_teleports->end(); ++tp) {
-				auto loc1 = locations.find(tp->get()->get("a"))->second;
-				auto loc2 = locations.find(tp->get()->get("b"))->second;
-				if(loc1.Coords.Within(player_coords, kCloseEnoughToTeleportFrom)) {
-					teleports.push_back(TeleportPair(world_name, loc1, loc2));
-				}
-			}
-		} // after this, the teleports vector is populated.
+	std::vector<TeleportPair> teleports;
+	foreach(nearby, world_teleports) {
+		teleports.insert(teleports.end(), nearby->begin(), nearby->end());
 	}
 	return teleports;
 }
 
-bool InvokeTeleport(std::string player, TeleportPair teleport) {
+std::vector<TeleportPair> InvokeGetTeleports(work_pool& world_work, std::string player, handler_job_ptr job) {
+	return CollectTeleports(world_work, *LoadWorlds(), player, job);
+}
+
+bool InvokeTeleport(WorldSwitchWorker& worker, work_pool& world_work, std::string player, TeleportPair teleport, handler_job_ptr job) {
 
-	auto teleports = InvokeGetTeleports(player);
+	auto teleports = InvokeGetTeleports(world_work, player, job);
+	if(job->cancelled())
+		return false;
 	foreach(possible_teleport, teleports) {
 		if(possible_teleport->Equals(teleport)) {
-			auto output = InvokeCommand(commands::teleport, list(3, player, possible_teleport->World, possible_teleport->Teleport2.Coords.ToString()));
-			return true;
+			return InvokeCommand(worker, commands::teleport, list(3, player, possible_teleport->World, possible_teleport->Teleport2.Coords.ToString()), job).success;
 		}
 	}
 	return false;
@@ -226,8 +275,7 @@ bool InvokeTeleport(std::string player, TeleportPair teleport) {
 //   pack and return list of valid teleports
 //   teleports formatted as  world:loc1:loc2
 //   packed in pipe-delimited string
-std::string GetPackedTeleportsList(std::string player) {
-	auto teleports = InvokeGetTeleports(player);
+std::string PackTeleports(const std::vector<TeleportPair>& teleports) {
 	std::stringstream packed_teleports;
 	foreach(teleport, teleports) {
 		packed_teleports << teleport->ToString() << minecraft::kDelimiter3;
@@ -238,42 +286,86 @@ std::string GetPackedTeleportsList(std::string player) {
 	return packed_string;
 }
 
+std::string GetPackedTeleportsList(work_pool& world_work, std::string player, handler_job_ptr job) {
+	return PackTeleports(InvokeGetTeleports(world_work, player, job));
+}
+
+// Everything the main menu shows, from one look at each world: the player's
+// file, their position and the world's teleports are each fetched once and
+// used for both lists, rather than once for get_teleports and again for
+// get_worldswitches.
+void CollectMenuState(work_pool& world_work, const WorldList& worlds, std::string player, handler_job_ptr job,
+	std::vector<TeleportPair>& teleports, vector_pair& worldswitches) {
+	std::vector<std::vector<TeleportPair>> world_teleports(worlds.size());
+	std::vector<char> valid(worlds.size(), false);
+
+	world_work.run_all(worlds.size(), [&](size_t i) {
+		if(job->cancelled())
+			return;
+		const WorldData& world = *(worlds[i].get());
+		if(!PlayerIsInWorld(world.path(), player))
+			return;
+
+		auto player_coords = InvokeGetCoordinates(player, world);
+		auto loaded = LoadTeleports(world);
+		world_teleports[i] = loaded->PairsNear(player_coords, kCloseEnoughToTeleportFrom);
+		valid[i] = loaded->index.AnyNear(player_coords, kCloseEnoughToTeleportFrom);
+	});
+
+	teleports.clear();
+	foreach(nearby, world_teleports) {
+		teleports.insert(teleports.end(), nearby->begin(), nearby->end());
+	}
+	worldswitches = PairWorlds(worlds, valid);
+}
+
+minecraft_service::minecraft_service(int world_threads)
+	: worker_(new WorldSwitchWorker(kExecutable, kIniFile)), world_work_(world_threads) {
+}
+
 // if the message is in the right format, 
 // this function invokes the WorldSwitch.exe with arguments from the message
-std::string minecraft_service::handle_message(std::string message) {
+MinecraftMessage minecraft_service::handle_message(const MinecraftMessage& message, handler_job_ptr job) {
 	
-	auto params = io_helpers::tokenize(message, minecraft::kDelimiter1); 
-
-	if(params.size() == 0)
-		return "";
+	if(message.empty())
+		return MinecraftMessage();
 
-	auto command = params[0];
-	auto player = params[1];
-	params.erase(params.begin());
-	params.erase(params.begin());
+	auto command = message.command();
+	auto player = message.user();
+	auto params = message.params();
 	int numparams = params.size();
 	
 	if(command == commands::worldswitch && numparams == 1) {
 		auto pair = params[0];
-		InvokeWorldSwitch(player, WorldSwitch(pair));
-		return ResponseCommand(commands::worldswitch_response, player, list(1, str("Transferred inventory between worlds")));
+		bool success = InvokeWorldSwitch(*worker_, player, WorldSwitch(pair), job);
+		if(success)
+			return ResponseCommand(commands::worldswitch_response, player, list(1, str("Transferred inventory between worlds")));
+		else
+			return ResponseCommand(commands::worldswitch_response, player, list(1, str("World switch failed")));
 	}
 	else if(command == commands::teleport && numparams == 1) {
 		TeleportPair teleport(params[0]);
-		bool success = InvokeTeleport(player, teleport);
+		bool success = InvokeTeleport(*worker_, world_work_, player, teleport, job);
 		if(success)
 			return ResponseCommand(commands::teleport_response, player, list(1, str("Teleported successfully")));
 		else
 			return ResponseCommand(commands::teleport_response, player, list(1, str("Teleport failed")));
 	}
 	else if(command == commands::get_teleports && numparams == 0) {
-		auto teleports = GetPackedTeleportsList(player);
+		auto teleports = GetPackedTeleportsList(world_work_, player, job);
 		return ResponseCommand(commands::get_teleports_response, player, list(1, teleports));
 	}
 	else if(command == commands::get_worldswitches && numparams == 0) {
-		auto worldswitches = GetPackedWorldsToSwitch(player);
+		auto worldswitches = GetPackedWorldsToSwitch(world_work_, player, job);
 		return ResponseCommand(commands::get_worldswitches_response, player, list(1, worldswitches));
 	}
+	else if(command == commands::get_menu_state && numparams == 0) {
+		std::vector<TeleportPair> teleports;
+		vector_pair worldswitches;
+		CollectMenuState(world_work_, *LoadWorlds(), player, job, teleports, worldswitches);
+		return ResponseCommand(commands::get_menu_state_response, player,
+			list(2, PackTeleports(teleports), PackWorldsToSwitch(worldswitches)));
+	}
 	else if(command == commands::login && numparams == 0) {
 		return ResponseCommand(commands::menu_response, player, list(0));
 	}
@@ -281,10 +373,10 @@ std::string minecraft_service::handle_message(std::string message) {
 		return ResponseCommand(commands::menu_response, player, list(0));
 	}
 	else {
-		std::cout << message << std::endl;
+		std::cout << message.AsMessage() << std::endl;
 	}
 
-	return "";
+	return MinecraftMessage();
 }
 
 
@@ -307,3 +399,96 @@ std::string minecraft_service::handle_message(std::string message) {
 
 
 
+
+
+// sessions are indexed by player when they log in, so replies and pushes can find them
+std::string minecraft_service::player_for(const MinecraftMessage& message) {
+	if(message.command() != commands::login)
+		return "";
+	return message.user();
+}
+
+// each command gets its own deadline, since a world switch rewrites two player files
+// while the menus only read
+boost::posix_time::time_duration minecraft_service::timeout_for(const MinecraftMessage& message) {
+	auto command = message.command();
+	if(command == commands::worldswitch)
+		return kWorldSwitchTimeout;
+	else if(command == commands::teleport)
+		return kTeleportTimeout;
+	else if(command == commands::get_teleports || command == commands::get_worldswitches
+		|| command == commands::get_menu_state)
+		return kMenuTimeout;
+	return kDefaultTimeout;
+}
+
+// sends the player back to the main menu when their request runs past its deadline
+MinecraftMessage minecraft_service::timeout_response(const MinecraftMessage& message) {
+	if(message.empty())
+		return MinecraftMessage();
+	return ResponseCommand(commands::menu_response, message.user(), list(1, str("Request timed out")));
+}
+namespace {
+
+	// Makes a world holding the sample player, with a teleports.csv of the given number of locations around them.
+	std::shared_ptr<WorldData> MakeBenchmarkWorld(std::string name, int locations) {
+		auto path = boost::filesystem::path("benchmark_worlds") / name;
+		boost::filesystem::create_directories(path / kPlayersDirectory);
+		boost::filesystem::copy_file("player_sample.dat", path / kPlayersDirectory / ("PhilipM" + kPlayerFileExtension));
+
+		std::ofstream teleports((path / kTeleportsFile).string().c_str());
+		teleports << "~locations,name,x,y,z" << std::endl;
+		for(int i = 0; i < locations; i++)
+			teleports << "loc" << i << "," << (i % 50) * 10 - 123 << ",64," << (i / 50) * 10 + 250 << std::endl;
+		teleports << "~teleports,id,a,b" << std::endl;
+		for(int i = 0; i < locations; i++)
+			teleports << "t" << i << ",loc" << i << ",loc" << (i + 1) % locations << std::endl;
+		return std::shared_ptr<WorldData>(new WorldData(name, path.string()));
+	}
+
+	// Times the first request, which reads every world's files, then the average of count more.
+	void TimeFanout(work_pool& world_work, const WorldList& worlds, handler_job_ptr job, int count, double& cold_ms, double& warm_ms) {
+		using boost::posix_time::microsec_clock;
+		auto start = microsec_clock::universal_time();
+		CollectTeleports(world_work, worlds, "PhilipM", job);
+		CollectWorldsToSwitch(world_work, worlds, "PhilipM", job);
+		cold_ms = (microsec_clock::universal_time() - start).total_microseconds() / 1e3;
+
+		start = microsec_clock::universal_time();
+		for(int i = 0; i < count; i++) {
+			CollectTeleports(world_work, worlds, "PhilipM", job);
+			CollectWorldsToSwitch(world_work, worlds, "PhilipM", job);
+		}
+		warm_ms = (microsec_clock::universal_time() - start).total_microseconds() / 1e3 / count;
+	}
+}
+
+void benchmark_world_fanout(int max_worlds, int threads, int count) {
+	std::cout << "benchmarking world fan-out..." << std::endl;
+	boost::asio::io_service io_service;
+	handler_job_ptr job(new handler_job(io_service, MinecraftMessage(), boost::posix_time::hours(1)));
+	work_pool one_at_a_time(1);
+	work_pool side_by_side(threads);
+	boost::filesystem::remove_all("benchmark_worlds");
+
+	const int world_counts[] = { 1, 2, 4, 8, 12, 16 };
+	BOOST_FOREACH(int world_count, world_counts) {
+		if(world_count > max_worlds)
+			break;
+		// each run gets worlds of its own, so that its first request finds nothing cached
+		WorldList sequential_worlds, parallel_worlds;
+		for(int i = 0; i < world_count; i++) {
+			std::stringstream name;
+			name << world_count << "_" << i;
+			sequential_worlds.push_back(MakeBenchmarkWorld("sequential_" + name.str(), 2000));
+			parallel_worlds.push_back(MakeBenchmarkWorld("parallel_" + name.str(), 2000));
+		}
+
+		double sequential_cold, sequential_warm, parallel_cold, parallel_warm;
+		TimeFanout(one_at_a_time, sequential_worlds, job, count, sequential_cold, sequential_warm);
+		TimeFanout(side_by_side, parallel_worlds, job, count, parallel_cold, parallel_warm);
+		std::cout << world_count << " worlds: first request " << sequential_cold << " ms -> " << parallel_cold
+			<< " ms, cached " << sequential_warm << " ms -> " << parallel_warm << " ms" << std::endl;
+	}
+	boost::filesystem::remove_all("benchmark_worlds");
+}
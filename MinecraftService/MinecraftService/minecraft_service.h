@@ -7,11 +7,28 @@
 #include <iostream>
 #include <list>
 #include <set>
-class minecraft_service {
+#include <boost/shared_ptr.hpp>
+#include "chat_server.h"
+#include "work_pool.h"
+
+class WorldSwitchWorker;
+
+class minecraft_service : public message_handler {
 public:
-	std::string handle_message(std::string message);
+	// world_threads bounds how many worlds are looked at at once for one request
+	minecraft_service(int world_threads);
+	MinecraftMessage handle_message(const MinecraftMessage& message, handler_job_ptr job);
+	std::string player_for(const MinecraftMessage& message);
+	boost::posix_time::time_duration timeout_for(const MinecraftMessage& message);
+	MinecraftMessage timeout_response(const MinecraftMessage& message);
 
 private:
+	boost::shared_ptr<WorldSwitchWorker> worker_;
+	work_pool world_work_;
+
 	void invoke_world_switch(std::string player, std::string world1, std::string world2);
 	void invoke_teleport(std::string world, std::string player, std::string teleport1, std::string teleport2);
-};
\ No newline at end of file
+};
+
+// Compares looking at each world in turn against the world pool, for growing numbers of worlds.
+void benchmark_world_fanout(int max_worlds, int threads, int count);
\ No newline at end of file
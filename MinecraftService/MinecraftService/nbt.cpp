@@ -0,0 +1,177 @@
+#include "stdafx.h"
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <assert.h>
+#include <boost/filesystem.hpp>
+
+#include "nbt.h"
+#include "gzip_reader.h"
+
+namespace {
+
+	// NBT numbers are big-endian.
+	unsigned long long ReadBigEndian(GzipReader& reader, int size) {
+		unsigned char bytes[8];
+		if(!reader.read(bytes, size))
+			throw std::runtime_error("unexpected end of nbt data");
+		unsigned long long value = 0;
+		for(int i = 0; i < size; i++)
+			value = (value << 8) | bytes[i];
+		return value;
+	}
+
+	int ReadByte(GzipReader& reader) {
+		return static_cast<int>(ReadBigEndian(reader, 1));
+	}
+
+	int ReadInt(GzipReader& reader) {
+		return static_cast<int>(static_cast<unsigned int>(ReadBigEndian(reader, 4)));
+	}
+
+	// the element count of an array or list, which can't be negative
+	int ReadLength(GzipReader& reader) {
+		int length = ReadInt(reader);
+		if(length < 0)
+			throw std::runtime_error("negative nbt length");
+		return length;
+	}
+
+	double ReadDouble(GzipReader& reader) {
+		unsigned long long bits = ReadBigEndian(reader, 8);
+		double value;
+		std::memcpy(&value, &bits, sizeof(value));
+		return value;
+	}
+
+	std::string ReadName(GzipReader& reader) {
+		size_t length = static_cast<size_t>(ReadBigEndian(reader, 2));
+		std::string name(length, '\0');
+		if(length > 0 && !reader.read(&name[0], length))
+			throw std::runtime_error("unexpected end of nbt data");
+		return name;
+	}
+
+	// Minecraft's own limit on how deeply lists and compounds may nest
+	const int kMaxDepth = 512;
+
+	// Arrays are sized in 64 bits, so a length times its element size can't overflow.
+	void Skip(GzipReader& reader, unsigned long long count) {
+		if(count > static_cast<size_t>(-1) || !reader.skip(static_cast<size_t>(count)))
+			throw std::runtime_error("unexpected end of nbt data");
+	}
+
+	// Skips over the payload of a tag without decoding it.
+	void SkipPayload(GzipReader& reader, int type, int depth) {
+		if(depth > kMaxDepth)
+			throw std::runtime_error("nbt tags nested too deeply");
+		switch(type) {
+		case nbt::kTagEnd: break;
+		case nbt::kTagByte: Skip(reader, 1); break;
+		case nbt::kTagShort: Skip(reader, 2); break;
+		case nbt::kTagInt: Skip(reader, 4); break;
+		case nbt::kTagLong: Skip(reader, 8); break;
+		case nbt::kTagFloat: Skip(reader, 4); break;
+		case nbt::kTagDouble: Skip(reader, 8); break;
+		case nbt::kTagByteArray: Skip(reader, ReadLength(reader)); break;
+		case nbt::kTagString: Skip(reader, ReadBigEndian(reader, 2)); break;
+		case nbt::kTagIntArray: Skip(reader, 4ULL * ReadLength(reader)); break;
+		case nbt::kTagLongArray: Skip(reader, 8ULL * ReadLength(reader)); break;
+		case nbt::kTagList: {
+			int element_type = ReadByte(reader);
+			int count = ReadLength(reader);
+			if(element_type == nbt::kTagEnd && count > 0)
+				throw std::runtime_error("nbt list of end tags");
+			for(int i = 0; i < count; i++)
+				SkipPayload(reader, element_type, depth + 1);
+			break;
+		}
+		case nbt::kTagCompound: {
+			int child_type;
+			while((child_type = ReadByte(reader)) != nbt::kTagEnd) {
+				Skip(reader, ReadBigEndian(reader, 2));
+				SkipPayload(reader, child_type, depth + 1);
+			}
+			break;
+		}
+		default:
+			throw std::runtime_error("unknown nbt tag type");
+		}
+	}
+}
+
+namespace nbt {
+
+	bool read_position(const std::string& path, double& x, double& y, double& z) {
+		if(!boost::filesystem::exists(path))
+			return false;
+
+		GzipReader reader(path);
+
+		// the file is one named root compound
+		if(ReadByte(reader) != kTagCompound)
+			throw std::runtime_error("nbt root is not a compound");
+		ReadName(reader);
+
+		int type;
+		while((type = ReadByte(reader)) != kTagEnd) {
+			std::string name = ReadName(reader);
+			if(type == kTagList && name == kPositionTag) {
+				int element_type = ReadByte(reader);
+				int count = ReadInt(reader);
+				if(element_type != kTagDouble || count != 3)
+					throw std::runtime_error("nbt Pos is not a list of three doubles");
+				x = ReadDouble(reader);
+				y = ReadDouble(reader);
+				z = ReadDouble(reader);
+				return true;
+			}
+			SkipPayload(reader, type, 1);
+		}
+		return false;
+	}
+
+	void test_nbt() {
+		std::cout << "testing nbt..." << std::endl;
+		double x = 0, y = 0, z = 0;
+		bool found = read_position("player_sample.dat", x, y, z);
+		assert(found);
+		assert(x == -123.5 && y == 64.0 && z == 250.25);
+		std::cout << x << ":" << y << ":" << z << std::endl;
+
+		assert(!read_position("no_such_player.dat", x, y, z));
+
+		// corrupt files throw rather than looping or reading past the data
+		const std::string corrupt_path = "test_nbt_corrupt.dat";
+		const char root[] = { kTagCompound, 0, 0 };
+		const char negative_array[] = { kTagByteArray, 0, 0, '\xff', '\xff', '\xff', '\xff', kTagEnd };
+		const char huge_array[] = { kTagLongArray, 0, 0, 0x7f, '\xff', '\xff', '\xff', kTagEnd };
+		const char end_list[] = { kTagList, 0, 0, kTagEnd, 0x7f, '\xff', '\xff', '\xff', kTagEnd };
+		std::string nested(root, sizeof(root));
+		nested.append(1, kTagList).append(2, '\0');
+		for(int i = 0; i < 1000; i++)
+			nested.append(1, kTagList).append(3, '\0').append(1, 1);
+		std::string corrupt[] = {
+			std::string(root, sizeof(root)) + std::string(negative_array, sizeof(negative_array)),
+			std::string(root, sizeof(root)) + std::string(huge_array, sizeof(huge_array)),
+			std::string(root, sizeof(root)) + std::string(end_list, sizeof(end_list)),
+			nested
+		};
+		BOOST_FOREACH(const std::string& contents, corrupt) {
+			{
+				std::ofstream file(corrupt_path.c_str(), std::ios::out | std::ios::binary);
+				file.write(contents.data(), contents.size());
+			}
+			bool threw = false;
+			try {
+				read_position(corrupt_path, x, y, z);
+			} catch(std::exception&) {
+				threw = true;
+			}
+			assert(threw);
+		}
+		boost::filesystem::remove(corrupt_path);
+		std::cout << "finished testing nbt" << std::endl;
+	}
+}
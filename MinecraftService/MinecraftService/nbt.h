@@ -0,0 +1,35 @@
+#pragma once
+
+#include "stdafx.h"
+#include <string>
+
+// Read-only access to Minecraft's NBT (named binary tag) files.
+// Tags are walked straight off the decompressed stream without building a tree,
+// and reading stops as soon as the requested tag has been decoded.
+namespace nbt {
+
+	enum TagType {
+		kTagEnd = 0,
+		kTagByte = 1,
+		kTagShort = 2,
+		kTagInt = 3,
+		kTagLong = 4,
+		kTagFloat = 5,
+		kTagDouble = 6,
+		kTagByteArray = 7,
+		kTagString = 8,
+		kTagList = 9,
+		kTagCompound = 10,
+		kTagIntArray = 11,
+		kTagLongArray = 12
+	};
+
+	const std::string kPositionTag = "Pos";
+
+	// Reads the three doubles of the root compound's "Pos" list from a player .dat file.
+	// Returns false if the file doesn't exist or has no position.
+	// Throws if the file is corrupt.
+	bool read_position(const std::string& path, double& x, double& y, double& z);
+
+	void test_nbt();
+}
@@ -0,0 +1,372 @@
+#include "stdafx.h"
+#include <iostream>
+#include <fstream>
+#include <assert.h>
+#include <boost/bind.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include "player_cache.h"
+#include "nbt.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__linux__)
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#endif
+
+// how often the watch thread wakes up to see if the cache is being destroyed
+const int kWatchWakeMilliseconds = 500;
+// how long a world whose directory couldn't be watched waits before trying again
+const int kWatchRetrySeconds = 30;
+// the most players cached for one world; one more drops an entry to make room
+const size_t kMaxPlayersPerWorld = 4096;
+
+PlayerCache::PlayerCache(std::string players_directory, std::string extension)
+	: players_directory_(players_directory), extension_(extension), worlds_(), hits_(0), misses_(0),
+	stopping_(false), watches_() {
+#if !defined(_WIN32)
+#ifdef __linux__
+	inotify_fd_ = inotify_init1(IN_CLOEXEC);
+#else
+	inotify_fd_ = -1;
+#endif
+	if(inotify_fd_ < 0)
+		std::cout << "player files can't be watched, checking them on every lookup instead" << std::endl;
+#endif
+}
+
+PlayerCache::~PlayerCache() {
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		stopping_ = true;
+	}
+	if(watch_thread_.joinable())
+		watch_thread_.join();
+#ifdef _WIN32
+	foreach(watch, watches_) {
+		FindCloseChangeNotification(watch->first);
+	}
+#else
+	if(inotify_fd_ >= 0)
+		close(inotify_fd_);
+#endif
+}
+
+PlayerPosition PlayerCache::get(const std::string& world_path, const std::string& player) {
+	std::string path = PlayerFile(world_path, player);
+	bool watched;
+	unsigned int generation;
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		World& world = worlds_[world_path];
+		if(!world.watched && std::time(NULL) >= world.retry_watch_at) {
+			if(Watch(world_path)) {
+				// anything cached before the watch started may have missed a change
+				world.watched = true;
+				world.players.clear();
+			}
+			else {
+				// don't try again on every lookup; the stamps below do until then
+				world.retry_watch_at = std::time(NULL) + kWatchRetrySeconds;
+			}
+		}
+		watched = world.watched;
+		generation = world.generation;
+		auto entry = world.players.find(player);
+		if(watched && entry != world.players.end()) {
+			hits_++;
+			return entry->second.position;
+		}
+	}
+
+	// without a watch, an entry is only good while the file looks the same
+	Stamp stamp = Stamp();
+	if(!watched) {
+		stamp = StampOf(path);
+		boost::mutex::scoped_lock lock(mutex_);
+		World& world = worlds_[world_path];
+		auto entry = world.players.find(player);
+		if(entry != world.players.end() && entry->second.stamp == stamp) {
+			hits_++;
+			return entry->second.position;
+		}
+	}
+
+	PlayerPosition position;
+	bool loaded = Load(path, position);
+	boost::mutex::scoped_lock lock(mutex_);
+	misses_++;
+	World& world = worlds_[world_path];
+	// A file that couldn't be read is read again next time, rather than kept as
+	// (0,0,0).  Nor is a missing one kept: the name comes from the client, and no
+	// notification would ever drop it.
+	if(loaded && position.exists && world.generation == generation) {
+		if(world.players.size() >= kMaxPlayersPerWorld && world.players.find(player) == world.players.end())
+			world.players.erase(world.players.begin());
+		Entry& entry = world.players[player];
+		entry.position = position;
+		entry.stamp = stamp;
+	}
+	return position;
+}
+
+size_t PlayerCache::size() {
+	boost::mutex::scoped_lock lock(mutex_);
+	size_t size = 0;
+	foreach(world, worlds_) {
+		size += world->second.players.size();
+	}
+	return size;
+}
+
+int PlayerCache::hits() {
+	boost::mutex::scoped_lock lock(mutex_);
+	return hits_;
+}
+
+int PlayerCache::misses() {
+	boost::mutex::scoped_lock lock(mutex_);
+	return misses_;
+}
+
+std::string PlayerCache::PlayersDirectory(const std::string& world_path) {
+	return (boost::filesystem::path(world_path) / players_directory_).string();
+}
+
+std::string PlayerCache::PlayerFile(const std::string& world_path, const std::string& player) {
+	return (boost::filesystem::path(world_path) / players_directory_ / (player + extension_)).string();
+}
+
+PlayerCache::Stamp PlayerCache::StampOf(const std::string& path) {
+	boost::system::error_code error;
+	Stamp stamp;
+	stamp.modified = boost::filesystem::last_write_time(path, error);
+	stamp.exists = !error;
+	stamp.size = stamp.exists ? boost::filesystem::file_size(path, error) : 0;
+	if(!stamp.exists)
+		stamp.modified = 0;
+	return stamp;
+}
+
+// Reads the player's position straight out of their player file.  Returns false
+// if the file is there but couldn't be read, leaving the coordinates at zero.
+bool PlayerCache::Load(const std::string& path, PlayerPosition& position) {
+	position = PlayerPosition();
+	position.exists = boost::filesystem::exists(path);
+	if(position.exists) {
+		try {
+			nbt::read_position(path, position.coords.x, position.coords.y, position.coords.z);
+		}
+		catch (std::exception& e) {
+			std::cout << "failed to read coordinates from " << path << ": " << e.what() << std::endl;
+			position.coords = Coordinates();
+			return false;
+		}
+	}
+	return true;
+}
+
+bool PlayerCache::Stopping() {
+	boost::mutex::scoped_lock lock(mutex_);
+	return stopping_;
+}
+
+// A change to a player file drops just that player; anything else in the directory is ignored.
+void PlayerCache::Invalidate(const std::string& world_path, const std::string& file_name) {
+	if(file_name.length() <= extension_.length() ||
+		file_name.compare(file_name.length() - extension_.length(), extension_.length(), extension_) != 0)
+		return;
+	std::string player = file_name.substr(0, file_name.length() - extension_.length());
+
+	boost::mutex::scoped_lock lock(mutex_);
+	World& world = worlds_[world_path];
+	world.generation++;
+	world.players.erase(player);
+}
+
+void PlayerCache::InvalidateWorld(const std::string& world_path) {
+	boost::mutex::scoped_lock lock(mutex_);
+	World& world = worlds_[world_path];
+	world.generation++;
+	world.players.clear();
+}
+
+#ifdef _WIN32
+
+// Windows change notifications don't say which file changed, so they drop the whole world.
+bool PlayerCache::Watch(const std::string& world_path) {
+	if(watches_.size() >= MAXIMUM_WAIT_OBJECTS)
+		return false;
+	HANDLE watch = FindFirstChangeNotificationA(PlayersDirectory(world_path).c_str(), FALSE,
+		FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE);
+	if(watch == INVALID_HANDLE_VALUE)
+		return false;
+	watches_[watch] = world_path;
+	if(!watch_thread_.joinable())
+		watch_thread_ = boost::thread(boost::bind(&PlayerCache::WatchLoop, this));
+	return true;
+}
+
+void PlayerCache::WatchLoop() {
+	while(!Stopping()) {
+		std::vector<HANDLE> handles;
+		std::vector<std::string> worlds;
+		{
+			boost::mutex::scoped_lock lock(mutex_);
+			foreach(watch, watches_) {
+				handles.push_back(watch->first);
+				worlds.push_back(watch->second);
+			}
+		}
+		DWORD result = WaitForMultipleObjects(static_cast<DWORD>(handles.size()), &handles[0], FALSE, kWatchWakeMilliseconds);
+		if(result >= WAIT_OBJECT_0 && result < WAIT_OBJECT_0 + handles.size()) {
+			size_t index = result - WAIT_OBJECT_0;
+			InvalidateWorld(worlds[index]);
+			FindNextChangeNotification(handles[index]);
+		}
+	}
+}
+
+#elif defined(__linux__)
+
+bool PlayerCache::Watch(const std::string& world_path) {
+	if(inotify_fd_ < 0)
+		return false;
+	int watch = inotify_add_watch(inotify_fd_, PlayersDirectory(world_path).c_str(),
+		IN_ONLYDIR | IN_CREATE | IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE);
+	if(watch < 0)
+		return false;
+	watches_[watch] = world_path;
+	if(!watch_thread_.joinable())
+		watch_thread_ = boost::thread(boost::bind(&PlayerCache::WatchLoop, this));
+	return true;
+}
+
+void PlayerCache::WatchLoop() {
+	// long keeps the buffer aligned for inotify_event
+	long buffer[1024];
+	while(!Stopping()) {
+		pollfd ready;
+		ready.fd = inotify_fd_;
+		ready.events = POLLIN;
+		if(poll(&ready, 1, kWatchWakeMilliseconds) <= 0)
+			continue;
+		ssize_t length = read(inotify_fd_, buffer, sizeof(buffer));
+		if(length <= 0)
+			continue;
+
+		const char* next = reinterpret_cast<const char*>(buffer);
+		const char* end = next + length;
+		while(next < end) {
+			const inotify_event* event = reinterpret_cast<const inotify_event*>(next);
+			next += sizeof(inotify_event) + event->len;
+
+			std::string world_path;
+			{
+				boost::mutex::scoped_lock lock(mutex_);
+				if(event->mask & IN_Q_OVERFLOW) {
+					// events were lost, so nothing cached can be trusted
+					foreach(world, worlds_) {
+						world->second.generation++;
+						world->second.players.clear();
+					}
+					continue;
+				}
+				auto watch = watches_.find(event->wd);
+				if(watch == watches_.end())
+					continue;
+				world_path = watch->second;
+				if(event->mask & IN_IGNORED) {
+					// the directory went away; go back to checking files until it can be watched again
+					watches_.erase(watch);
+					worlds_[world_path].watched = false;
+				}
+			}
+			if(event->len > 0)
+				Invalidate(world_path, event->name);
+			else
+				InvalidateWorld(world_path);
+		}
+	}
+}
+
+#else
+
+bool PlayerCache::Watch(const std::string& world_path) {
+	return false;
+}
+
+void PlayerCache::WatchLoop() {
+}
+
+#endif
+
+void test_player_cache() {
+	std::cout << "testing player cache..." << std::endl;
+	const std::string world = "player_cache_test";
+	auto players = boost::filesystem::path(world) / "players";
+	auto player_file = (players / "sample.dat").string();
+	boost::filesystem::remove_all(world);
+	boost::filesystem::create_directories(players);
+
+	PlayerCache cache("players", ".dat");
+	// change notifications arrive a little after the change
+	auto wait_for = [&](bool exists) -> PlayerPosition {
+		PlayerPosition position;
+		for(int i = 0; i < 40; i++) {
+			position = cache.get(world, "sample");
+			if(position.exists == exists)
+				break;
+			boost::this_thread::sleep(boost::posix_time::milliseconds(50));
+		}
+		return position;
+	};
+
+	assert(!cache.get(world, "sample").exists);
+	boost::filesystem::copy_file("player_sample.dat", player_file);
+	auto position = wait_for(true);
+	assert(position.exists);
+	assert(position.coords.x == -123.5 && position.coords.y == 64.0 && position.coords.z == 250.25);
+
+	int hits = cache.hits();
+	int misses = cache.misses();
+	cache.get(world, "sample");
+	assert(cache.hits() == hits + 1 && cache.misses() == misses);
+
+	boost::filesystem::remove(player_file);
+	assert(!wait_for(false).exists);
+
+	// a file that can't be read is reported but not cached
+	{
+		std::ofstream file(player_file.c_str(), std::ios::binary);
+		file << "not a player file";
+	}
+	position = wait_for(true);
+	assert(position.exists && position.coords.x == 0);
+	misses = cache.misses();
+	cache.get(world, "sample");
+	assert(cache.misses() == misses + 1);
+	boost::filesystem::remove(player_file);
+	assert(!wait_for(false).exists);
+
+	// names with no player file aren't cached, however many are looked up
+	size_t cached = cache.size();
+	for(int i = 0; i < 10000; i++)
+		assert(!cache.get(world, "nobody" + std::to_string((long long)i)).exists);
+	assert(cache.size() == cached);
+
+	// a world without a players directory can't be watched, but its files are still checked
+	const std::string unwatched = "player_cache_test_unwatched";
+	boost::filesystem::remove_all(unwatched);
+	assert(!cache.get(unwatched, "sample").exists);
+	boost::filesystem::create_directories(boost::filesystem::path(unwatched) / "players");
+	boost::filesystem::copy_file("player_sample.dat", (boost::filesystem::path(unwatched) / "players" / "sample.dat").string());
+	assert(cache.get(unwatched, "sample").coords.z == 250.25);
+	boost::filesystem::remove_all(unwatched);
+
+	boost::filesystem::remove_all(world);
+	std::cout << "finished testing player cache" << std::endl;
+}
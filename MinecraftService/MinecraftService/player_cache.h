@@ -0,0 +1,98 @@
+#pragma once
+
+#include "stdafx.h"
+#include <ctime>
+#include <map>
+#include <string>
+#include <boost/cstdint.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include "../../shared/minecraft_shared.hpp"
+
+// What a world's player file says about a player.
+struct PlayerPosition {
+	bool exists;
+	Coordinates coords;
+
+	PlayerPosition() : exists(false), coords() {}
+};
+
+// PlayerCache remembers each player's position in each world, so menu requests don't
+// read the same player files over and over.  The Minecraft server only rewrites them
+// on autosave, so entries stay good until a change notification arrives for the
+// world's players directory (inotify on Linux, change notifications on Windows).
+//
+// When a directory can't be watched, entries fall back to being checked against the
+// file's modification time and size on every lookup, and the watch is tried again
+// now and then.  A player file that can't be read is never cached, nor is a player
+// with no file, and each world keeps at most kMaxPlayersPerWorld players.
+class PlayerCache {
+public:
+	PlayerCache(std::string players_directory, std::string extension);
+	~PlayerCache();
+
+	PlayerPosition get(const std::string& world_path, const std::string& player);
+
+	// how many players are cached across every world
+	size_t size();
+	int hits();
+	int misses();
+
+private:
+	struct Stamp {
+		std::time_t modified;
+		boost::uintmax_t size;
+		bool exists;
+		bool operator==(const Stamp& other) const {
+			return exists == other.exists && modified == other.modified && size == other.size;
+		}
+	};
+
+	struct Entry {
+		PlayerPosition position;
+		Stamp stamp;
+	};
+
+	struct World {
+		bool watched;
+		// when a world that couldn't be watched may try again
+		std::time_t retry_watch_at;
+		// bumped on every invalidation, so a load that raced with a change isn't kept
+		unsigned int generation;
+		std::map<std::string, Entry> players;
+		World() : watched(false), retry_watch_at(0), generation(0), players() {}
+	};
+
+	std::string PlayerFile(const std::string& world_path, const std::string& player);
+	std::string PlayersDirectory(const std::string& world_path);
+	static Stamp StampOf(const std::string& path);
+	static bool Load(const std::string& path, PlayerPosition& position);
+
+	// Starts watching the world's players directory.  Called with mutex_ held.
+	bool Watch(const std::string& world_path);
+	void WatchLoop();
+	bool Stopping();
+	void Invalidate(const std::string& world_path, const std::string& file_name);
+	void InvalidateWorld(const std::string& world_path);
+
+	std::string players_directory_;
+	std::string extension_;
+
+	boost::mutex mutex_;
+	std::map<std::string, World> worlds_;
+	int hits_;
+	int misses_;
+
+	bool stopping_;
+	boost::thread watch_thread_;
+#ifdef _WIN32
+	// change notification handle for each watched world
+	std::map<void*, std::string> watches_;
+#else
+	int inotify_fd_;
+	// inotify watch descriptor for each watched world
+	std::map<int, std::string> watches_;
+#endif
+};
+
+void test_player_cache();
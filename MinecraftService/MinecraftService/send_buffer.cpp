@@ -0,0 +1,124 @@
+#include "stdafx.h"
+#include <iostream>
+#include <assert.h>
+
+#include "send_buffer.h"
+
+// enough for every session's queued frames under normal load
+const size_t kMaxFreeSendBuffers = 1024;
+// a buffer that grew for one unusually long frame isn't worth keeping
+const size_t kMaxKeptSendBufferSize = 16 * 1024;
+
+send_buffer_pool global_send_buffers(kMaxFreeSendBuffers, kMaxKeptSendBufferSize);
+
+send_buffer_pool& send_buffers() {
+	return global_send_buffers;
+}
+
+
+send_buffer::send_buffer(send_buffer_pool& pool)
+	: pool_(pool), references_(0), bytes_(), sealed_(false) {
+}
+
+std::string& send_buffer::contents() {
+	assert(!sealed_);
+	return bytes_;
+}
+
+void send_buffer::seal() {
+	sealed_ = true;
+}
+
+boost::asio::const_buffers_1 send_buffer::buffer() const {
+	return boost::asio::buffer(bytes_.data(), bytes_.size());
+}
+
+size_t send_buffer::size() const {
+	return bytes_.size();
+}
+
+void intrusive_ptr_add_ref(send_buffer* buffer) {
+	++buffer->references_;
+}
+
+void intrusive_ptr_release(send_buffer* buffer) {
+	if(--buffer->references_ == 0)
+		buffer->pool_.give_back(buffer);
+}
+
+
+send_buffer_pool::send_buffer_pool(size_t max_free, size_t max_kept_size)
+	: max_free_(max_free), max_kept_size_(max_kept_size), free_(), created_(0), reused_(0) {
+}
+
+send_buffer_pool::~send_buffer_pool() {
+	foreach(buffer, free_) {
+		delete *buffer;
+	}
+}
+
+send_buffer_ptr send_buffer_pool::take() {
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		if(!free_.empty()) {
+			send_buffer* buffer = free_.back();
+			free_.pop_back();
+			reused_++;
+			return send_buffer_ptr(buffer);
+		}
+		created_++;
+	}
+	return send_buffer_ptr(new send_buffer(*this));
+}
+
+void send_buffer_pool::give_back(send_buffer* buffer) {
+	if(buffer->bytes_.capacity() <= max_kept_size_) {
+		// clear() keeps the capacity, which is the point of keeping the buffer
+		buffer->bytes_.clear();
+		buffer->sealed_ = false;
+		boost::mutex::scoped_lock lock(mutex_);
+		if(free_.size() < max_free_) {
+			free_.push_back(buffer);
+			return;
+		}
+	}
+	delete buffer;
+}
+
+int send_buffer_pool::created() {
+	boost::mutex::scoped_lock lock(mutex_);
+	return created_;
+}
+
+int send_buffer_pool::reused() {
+	boost::mutex::scoped_lock lock(mutex_);
+	return reused_;
+}
+
+void test_send_buffer() {
+	std::cout << "testing send buffers..." << std::endl;
+	send_buffer_pool pool(1, 64);
+
+	send_buffer_ptr first = pool.take();
+	first->contents() = "  17menu_response,Bob";
+	first->seal();
+	send_buffer_ptr shared = first;
+	first.reset();
+	assert(shared->size() == 21);
+	const void* bytes = boost::asio::buffer_cast<const void*>(shared->buffer());
+	shared.reset();
+
+	// the released buffer comes back empty, with its memory
+	send_buffer_ptr second = pool.take();
+	assert(pool.created() == 1 && pool.reused() == 1);
+	assert(second->size() == 0);
+	second->contents() = "  17menu_response,Bob";
+	assert(boost::asio::buffer_cast<const void*>(second->buffer()) == bytes);
+
+	// one that grew too large is let go
+	second->contents().append(100, ' ');
+	second.reset();
+	pool.take();
+	assert(pool.created() == 2);
+	std::cout << "finished testing send buffers" << std::endl;
+}
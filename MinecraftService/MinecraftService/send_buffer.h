@@ -0,0 +1,75 @@
+#pragma once
+
+#include "stdafx.h"
+#include <string>
+#include <vector>
+#include <boost/asio/buffer.hpp>
+#include <boost/detail/atomic_count.hpp>
+#include <boost/intrusive_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+class send_buffer_pool;
+
+// One encoded frame waiting to be written to one or more sessions.  It is
+// filled once, sealed, and from then on only read, so any number of sessions
+// can write the same bytes without copying them.  When the last reference
+// goes away the buffer, and the memory it grew, goes back to its pool.
+class send_buffer {
+public:
+	// The bytes to fill in.  Only valid before seal().
+	std::string& contents();
+
+	void seal();
+
+	boost::asio::const_buffers_1 buffer() const;
+
+	size_t size() const;
+
+private:
+	friend class send_buffer_pool;
+	friend void intrusive_ptr_add_ref(send_buffer* buffer);
+	friend void intrusive_ptr_release(send_buffer* buffer);
+
+	send_buffer(send_buffer_pool& pool);
+
+	send_buffer_pool& pool_;
+	boost::detail::atomic_count references_;
+	std::string bytes_;
+	bool sealed_;
+};
+
+typedef boost::intrusive_ptr<send_buffer> send_buffer_ptr;
+
+void intrusive_ptr_add_ref(send_buffer* buffer);
+void intrusive_ptr_release(send_buffer* buffer);
+
+// Keeps released send buffers so that their memory is used again.
+class send_buffer_pool {
+public:
+	// At most max_free buffers are kept, and none that grew past max_kept_size.
+	send_buffer_pool(size_t max_free, size_t max_kept_size);
+	~send_buffer_pool();
+
+	// An empty, unsealed buffer.
+	send_buffer_ptr take();
+
+	int created();
+	int reused();
+
+private:
+	friend void intrusive_ptr_release(send_buffer* buffer);
+
+	void give_back(send_buffer* buffer);
+
+	size_t max_free_;
+	size_t max_kept_size_;
+	boost::mutex mutex_;
+	std::vector<send_buffer*> free_;
+	int created_;
+	int reused_;
+};
+
+// the pool every session's frames come from
+send_buffer_pool& send_buffers();
+
+void test_send_buffer();
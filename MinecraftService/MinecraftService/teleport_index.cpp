@@ -0,0 +1,183 @@
+#include "stdafx.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <assert.h>
+#include <boost/functional/hash.hpp>
+
+#include "teleport_index.h"
+
+TeleportIndex::TeleportIndex(double cell_size) : cell_size_(cell_size), size_(0), cells_() {
+}
+
+size_t TeleportIndex::CellHash::operator()(const Cell& cell) const {
+	size_t seed = 0;
+	boost::hash_combine(seed, cell.x);
+	boost::hash_combine(seed, cell.y);
+	boost::hash_combine(seed, cell.z);
+	return seed;
+}
+
+// far enough out that no real coordinate gets there, and well inside a long long
+const double kMaxCell = 1e15;
+
+bool IsFinite(const Coordinates& coords) {
+	// NaN and infinity are the only values for which this isn't zero
+	return coords.x - coords.x == 0 && coords.y - coords.y == 0 && coords.z - coords.z == 0;
+}
+
+// value must be finite; a cell past kMaxCell is clamped to it, so the cast is always defined
+long long TeleportIndex::CellOf(double value) const {
+	double cell = std::floor(value / cell_size_);
+	return static_cast<long long>((std::max)(-kMaxCell, (std::min)(cell, kMaxCell)));
+}
+
+void TeleportIndex::Add(const Teleport& teleport) {
+	if(!IsFinite(teleport.Coords))
+		return;
+	Cell cell = { CellOf(teleport.Coords.x), CellOf(teleport.Coords.y), CellOf(teleport.Coords.z) };
+	cells_[cell].push_back(teleport);
+	size_++;
+}
+
+template <typename Visitor>
+bool TeleportIndex::Visit(const Coordinates& point, double distance, Visitor& visit) const {
+	if(cells_.empty() || !IsFinite(point))
+		return false;
+	Cell cell;
+	for(cell.x = CellOf(point.x - distance); cell.x <= CellOf(point.x + distance); cell.x++) {
+		for(cell.y = CellOf(point.y - distance); cell.y <= CellOf(point.y + distance); cell.y++) {
+			for(cell.z = CellOf(point.z - distance); cell.z <= CellOf(point.z + distance); cell.z++) {
+				auto found = cells_.find(cell);
+				if(found == cells_.end())
+					continue;
+				foreach(teleport, found->second) {
+					if(teleport->Coords.Within(point, distance) && visit(*teleport))
+						return true;
+				}
+			}
+		}
+	}
+	return false;
+}
+
+namespace {
+	struct CollectTeleports {
+		std::vector<const Teleport*> found;
+		bool operator()(const Teleport& teleport) {
+			found.push_back(&teleport);
+			return false;
+		}
+	};
+	struct StopAtFirst {
+		bool operator()(const Teleport&) { return true; }
+	};
+}
+
+std::vector<const Teleport*> TeleportIndex::Near(const Coordinates& point, double distance) const {
+	CollectTeleports collect;
+	Visit(point, distance, collect);
+	return collect.found;
+}
+
+bool TeleportIndex::AnyNear(const Coordinates& point, double distance) const {
+	StopAtFirst stop;
+	return Visit(point, distance, stop);
+}
+
+size_t TeleportIndex::size() const {
+	return size_;
+}
+
+const Teleport& WorldTeleports::AddLocation(const Teleport& location) {
+	auto added = locations.insert(std::make_pair(location.Location, location));
+	if(added.second)
+		index.Add(location);
+	return added.first->second;
+}
+
+std::vector<TeleportPair> WorldTeleports::PairsNear(const Coordinates& point, double distance) const {
+	std::vector<size_t> matches;
+	auto nearby = index.Near(point, distance);
+	foreach(location, nearby) {
+		auto range = pairs_from.equal_range((*location)->Location);
+		for(auto pair = range.first; pair != range.second; ++pair)
+			matches.push_back(pair->second);
+	}
+	// each name is indexed once, but a pair is still only ever sent once
+	std::sort(matches.begin(), matches.end());
+	matches.erase(std::unique(matches.begin(), matches.end()), matches.end());
+
+	std::vector<TeleportPair> near_pairs;
+	foreach(match, matches) {
+		near_pairs.push_back(pairs[*match]);
+	}
+	return near_pairs;
+}
+
+// Checks the grid against a plain scan over random points, including cell edges and negative coordinates.
+void test_teleport_index() {
+	std::cout << "testing teleport index..." << std::endl;
+	const double distance = 20;
+	TeleportIndex index(distance);
+	std::vector<Teleport> all;
+	srand(42);
+	for(int i = 0; i < 2000; i++) {
+		std::stringstream name;
+		name << "loc" << i;
+		Coordinates coords;
+		coords.x = (rand() % 2000) - 1000;
+		coords.y = rand() % 256;
+		coords.z = (rand() % 2000) - 1000;
+		all.push_back(Teleport("world", name.str(), coords));
+		index.Add(all.back());
+	}
+	assert(index.size() == all.size());
+
+	for(int i = 0; i < 500; i++) {
+		Coordinates point;
+		point.x = (rand() % 2100) - 1050 + 0.5;
+		point.y = rand() % 256;
+		point.z = (rand() % 2100) - 1050 - 0.5;
+		size_t expected = 0;
+		foreach(teleport, all) {
+			if(teleport->Coords.Within(point, distance))
+				expected++;
+		}
+		assert(index.Near(point, distance).size() == expected);
+		assert(index.AnyNear(point, distance) == (expected > 0));
+	}
+
+	// a location name given twice keeps its first coordinates, and its pairs come back once
+	WorldTeleports world(distance);
+	Coordinates first, second, far_away;
+	first.x = 0; first.y = 64; first.z = 0;
+	second = first;
+	second.x = 5;
+	far_away = first;
+	far_away.x = 500;
+	world.AddLocation(Teleport("world", "spawn", first));
+	world.AddLocation(Teleport("world", "spawn", far_away));
+	world.AddLocation(Teleport("world", "spawn", second));
+	const Teleport& tower = world.AddLocation(Teleport("world", "tower", far_away));
+	assert(world.index.size() == 2 && world.locations["spawn"].Coords.x == 0);
+	world.pairs_from.insert(std::make_pair(std::string("spawn"), world.pairs.size()));
+	world.pairs.push_back(TeleportPair("world", world.locations["spawn"], tower));
+	assert(world.PairsNear(first, distance).size() == 1);
+	assert(world.PairsNear(far_away, distance).empty());
+
+	// coordinates that aren't finite are never indexed nor found, and huge ones are still found
+	TeleportIndex odd(distance);
+	Coordinates nan_point = first, infinite = first, huge = first;
+	nan_point.x = std::numeric_limits<double>::quiet_NaN();
+	infinite.z = -std::numeric_limits<double>::infinity();
+	huge.y = 1e300;
+	odd.Add(Teleport("world", "nan", nan_point));
+	odd.Add(Teleport("world", "infinite", infinite));
+	odd.Add(Teleport("world", "huge", huge));
+	assert(odd.size() == 1 && !IsFinite(nan_point) && !IsFinite(infinite) && IsFinite(huge));
+	assert(odd.Near(nan_point, distance).empty() && !odd.AnyNear(infinite, distance));
+	assert(odd.Near(huge, distance).size() == 1 && odd.Near(first, distance).empty());
+	std::cout << "finished testing teleport index" << std::endl;
+}
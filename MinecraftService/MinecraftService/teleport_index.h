@@ -0,0 +1,78 @@
+#pragma once
+
+#include "stdafx.h"
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <string>
+#include <sstream>
+#include <unordered_map>
+#include <vector>
+#include "../../shared/minecraft_shared.hpp"
+
+// TeleportIndex buckets teleport locations into a uniform grid of cubes, so finding the
+// locations near a point only looks at the few cells around it instead of every location.
+// Queries use the same per-axis test as Coordinates::Within.
+class TeleportIndex {
+public:
+	// cell_size works best at about the distance that will be queried
+	TeleportIndex(double cell_size);
+
+	// A location with a coordinate that is NaN or infinite is left out, and a query
+	// at such a point finds nothing.
+	void Add(const Teleport& teleport);
+
+	// Returns every location within distance of the point.  The pointers stay valid
+	// as long as the index does and nothing more is added.
+	std::vector<const Teleport*> Near(const Coordinates& point, double distance) const;
+
+	bool AnyNear(const Coordinates& point, double distance) const;
+
+	size_t size() const;
+
+private:
+	struct Cell {
+		long long x, y, z;
+		bool operator==(const Cell& other) const {
+			return x == other.x && y == other.y && z == other.z;
+		}
+	};
+	struct CellHash {
+		size_t operator()(const Cell& cell) const;
+	};
+
+	long long CellOf(double value) const;
+
+	// Calls visit on each location near the point until it returns true.  Returns whether one did.
+	template <typename Visitor>
+	bool Visit(const Coordinates& point, double distance, Visitor& visit) const;
+
+	double cell_size_;
+	size_t size_;
+	std::unordered_map<Cell, std::vector<Teleport>, CellHash> cells_;
+};
+
+// whether none of the coordinates is NaN or infinite
+bool IsFinite(const Coordinates& coords);
+
+// Everything loaded from a world's teleports.csv: the named locations, a spatial index
+// over them, and the teleports between them in file order, looked up by starting location.
+struct WorldTeleports {
+	std::map<std::string, Teleport> locations;
+	TeleportIndex index;
+	std::vector<TeleportPair> pairs;
+	std::multimap<std::string, size_t> pairs_from;
+
+	WorldTeleports(double cell_size) : locations(), index(cell_size), pairs(), pairs_from() {}
+
+	// Adds a named location to locations and the index, unless one with the same
+	// name came first.  Returns the location kept under that name.  One that isn't
+	// finite is kept by name but never found near anything.
+	const Teleport& AddLocation(const Teleport& location);
+
+	// Returns the teleports that start within distance of the point, in file order.
+	std::vector<TeleportPair> PairsNear(const Coordinates& point, double distance) const;
+};
+typedef std::shared_ptr<WorldTeleports> WorldTeleportsPtr;
+
+void test_teleport_index();
@@ -4,8 +4,10 @@
 #include <string>
 #include <iostream>
 #include <fstream>
-#include <boost/function.hpp>
+#include <map>
 #include <boost/bind.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
 #include "io_helpers.h"
 
 void test_variable_bin(){
@@ -22,48 +24,271 @@ void test_variable_bin(){
 	assert(myint == 55);
 	std::cout << bin->get_int("myint42") << std::endl;
 	std::cout << bin->get_int("myint1") << std::endl;
+	bin->put_int("55", 56);
+	assert(bin->get_int("55") == 55);
+	bin->Int["55"] = 57;
+	assert(bin->get_int("55") == 57);
+	assert(bin->get_int("never set") == 0 && bin->get_int("never set", 7) == 7);
+	assert(bin->get_string("never set").empty());
+
+	// keys are found from views into larger strings, and survive the table growing
+	flat_string_map<int> map;
+	for(int i = 0; i < 1000; i++)
+		assert(map.insert("key" + std::to_string((long long)i), i).second);
+	assert(map.size() == 1000);
+	assert(!map.insert("key7", 70).second && *map.find("key7") == 7);
+	std::string line = "key12,key999";
+	assert(*map.find(util::string_view(line.data(), 5)) == 12);
+	assert(*map.find(util::string_view(line.data() + 6, 6)) == 999);
+	assert(map.find("key1000") == NULL && map.find("") == NULL);
+	map[""] = -1;
+	assert(*map.find("") == -1 && map.size() == 1001);
+
+	// a reload publishes a new snapshot and leaves the old one readable
+	const std::string path = "test_variable_bin.ini";
+	{
+		std::ofstream file(path.c_str());
+		file << "#a = 1\n$s = one\n// #commented = 1\n";
+	}
+	variable_bin settings;
+	assert(!settings.reload_if_changed());
+	settings.load_from_file(path);
+	const settings_snapshot& before = settings.snapshot();
+	assert(settings.get_int("a") == 1 && settings.get_string("s") == "one");
+	assert(before.find_int("commented") == NULL);
+	assert(!settings.reload_if_changed());
+	{
+		std::ofstream file(path.c_str());
+		file << "#a = 22\n$s = two\n#b = 3\n";
+	}
+	assert(settings.reload_if_changed());
+	assert(settings.get_int("a") == 22 && settings.get_string("s") == "two" && settings.get_int("b") == 3);
+	assert(*before.find_int("a") == 1 && *before.find_string("s") == "one" && before.find_int("b") == NULL);
+	assert(!settings.reload_if_changed());
+
+	// only the latest snapshots are kept, however many writes there are
+	for(int i = 0; i < 100; i++)
+		settings.Int["counter"] = i;
+	assert(settings.get_int("counter") == 99);
+	assert(settings.snapshot_count() == variable_bin::kRetainedSnapshots);
+
+	// the watch thread notices the file changing
+	settings.watch(boost::posix_time::milliseconds(10));
+	{
+		std::ofstream file(path.c_str());
+		file << "#a = 333\n";
+	}
+	for(int waited = 0; waited < 5000 && settings.get_int("a") != 333; waited += 10)
+		boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+	assert(settings.get_int("a") == 333);
+	boost::filesystem::remove(path);
+}
+
+namespace {
+	const char int_type_specifier = '#';
+	const char string_type_specifier = '$';
+}
+
+void benchmark_variable_bin(int lookups) {
+	using boost::posix_time::microsec_clock;
+	std::cout << "benchmarking variable_bin..." << std::endl;
+
+	// the settings main reads, looked up the way it does
+	const char* keys[] = { "io_threads", "work_threads", "world_threads", "flush_bytes",
+		"low_water_bytes", "high_water_bytes", "max_queued_bytes" };
+	const int key_count = sizeof(keys) / sizeof(keys[0]);
+	std::map<std::string, int> ordered;
+	variable_bin settings;
+	for(int i = 0; i < key_count; i++) {
+		ordered[keys[i]] = i;
+		settings.put_int(keys[i], i);
+	}
+
+	long long total = 0;
+	auto start = microsec_clock::universal_time();
+	for(int i = 0; i < lookups; i++)
+		total += ordered.find(keys[i % key_count])->second;
+	double map_ms = (microsec_clock::universal_time() - start).total_microseconds() / 1e3;
+
+	start = microsec_clock::universal_time();
+	for(int i = 0; i < lookups; i++)
+		total += settings.get_int(keys[i % key_count], 0);
+	double flat_ms = (microsec_clock::universal_time() - start).total_microseconds() / 1e3;
+
+	std::cout << lookups << " lookups: " << map_ms << " ms with std::map, "
+		<< flat_ms << " ms with flat_string_map (" << total << ")" << std::endl;
+}
+
+IntegerMap::entry& IntegerMap::entry::operator=(int value) {
+	bin_->set_int(key_, value);
+	return *this;
+}
+
+IntegerMap::entry::operator int() const {
+	return bin_->get_int(key_, 0);
 }
 
 variable_bin::variable_bin(void) :
-	string_map(), int_map(), Int(&(this->int_map))
+	Int(this), current_(NULL), write_mutex_(), snapshots_(), path_(), stamp_(), watch_thread_()
 {
+	publish(std::unique_ptr<settings_snapshot>(new settings_snapshot()));
 }
 
 variable_bin::~variable_bin(void)
 {
+	watch_thread_.interrupt();
+	if(watch_thread_.joinable())
+		watch_thread_.join();
 }
 
-const char int_type_specifier = '#';
-const char string_type_specifier = '$';
-
-// splits the string at the first '='.  If the first character is $, the value will be stored as a string, otherwise as an integer.
-void variable_bin::process_file_input(std::string line) {
-	std::cout << line << std::endl;
-	int indexOfEquals = line.find_first_of('=');
-	if(indexOfEquals == std::string::npos)
+// splits the line at the first '='.  If the first character is $, the value will be stored as a string, if it's # as an integer.
+void variable_bin::parse_line(util::string_view line, settings_snapshot& into) {
+	size_t equals = line.find('=');
+	if(equals == util::string_view::npos)
 		return;
 
 	char type_specifier = line[0];
-	auto key = io_helpers::trim(line.substr(1, indexOfEquals - 1));
-	auto value = io_helpers::trim(line.substr(indexOfEquals + 1, line.length() - indexOfEquals - 1));
+	auto key = io_helpers::trim_line(line.substr(1, equals - 1));
+	auto value = io_helpers::trim_line(line.substr(equals + 1));
 
 	if(type_specifier == int_type_specifier)
-		put_int(key, atoi(value.c_str()));
+		into.ints_.insert(key, atoi(value.str().c_str()));
 	else if(type_specifier == string_type_specifier)
-		put_string(key, value); 
+		into.strings_.insert(key, value.str());
 }
+
+void variable_bin::parse_file(const std::string& path, settings_snapshot& into) {
+	io_helpers::for_each_line(path, [&into](util::string_view line) -> bool {
+		parse_line(line, into);
+		return true;
+	});
+}
+
+variable_bin::file_stamp variable_bin::stamp_of(const std::string& path) {
+	boost::system::error_code error;
+	file_stamp stamp;
+	stamp.modified = boost::filesystem::last_write_time(path, error);
+	stamp.exists = !error;
+	stamp.size = stamp.exists ? boost::filesystem::file_size(path, error) : 0;
+	if(!stamp.exists)
+		stamp.modified = 0;
+	return stamp;
+}
+
+std::unique_ptr<settings_snapshot> variable_bin::copy_current() const {
+	return std::unique_ptr<settings_snapshot>(new settings_snapshot(*current_));
+}
+
+void variable_bin::publish(std::unique_ptr<settings_snapshot> snapshot) {
+	const settings_snapshot* published = snapshot.get();
+	snapshots_.push_back(std::unique_ptr<const settings_snapshot>(snapshot.release()));
+	// the oldest is freed only after the new one is published, below
+	std::unique_ptr<const settings_snapshot> retired;
+	if(snapshots_.size() > kRetainedSnapshots) {
+		retired = std::move(snapshots_.front());
+		snapshots_.pop_front();
+	}
+#ifdef _WIN32
+	// this compiler gives volatile writes release semantics
+	current_ = published;
+#else
+	__atomic_store_n(&current_, published, __ATOMIC_RELEASE);
+#endif
+}
+
+const settings_snapshot& variable_bin::snapshot() const {
+#ifdef _WIN32
+	// ...and volatile reads acquire semantics
+	return *current_;
+#else
+	return *__atomic_load_n(&current_, __ATOMIC_ACQUIRE);
+#endif
+}
+
 void variable_bin::load_from_file(std::string path) {
-	io_helpers::iterate_file(boost::bind(&variable_bin::process_file_input, shared_from_this(), _1), path);
+	boost::mutex::scoped_lock lock(write_mutex_);
+	// stamped before reading, so a write during the read is picked up by the next reload
+	file_stamp stamp = stamp_of(path);
+	std::unique_ptr<settings_snapshot> loaded = copy_current();
+	parse_file(path, *loaded);
+	path_ = path;
+	stamp_ = stamp;
+	publish(std::move(loaded));
 }
-std::string variable_bin::get_string(std::string key) {
-	return string_map.find(key)->second;
+
+bool variable_bin::reload_if_changed() {
+	boost::mutex::scoped_lock lock(write_mutex_);
+	if(path_.empty())
+		return false;
+	file_stamp stamp = stamp_of(path_);
+	if(!stamp.exists || stamp == stamp_)
+		return false;
+	std::unique_ptr<settings_snapshot> loaded(new settings_snapshot());
+	parse_file(path_, *loaded);
+	stamp_ = stamp;
+	publish(std::move(loaded));
+	std::cout << "reloaded " << path_ << std::endl;
+	return true;
 }
-int variable_bin::get_int(std::string key) {
-	return int_map.find(key)->second;
+
+void variable_bin::watch(boost::posix_time::time_duration interval) {
+	boost::mutex::scoped_lock lock(write_mutex_);
+	if(watch_thread_.joinable())
+		return;
+	watch_thread_ = boost::thread(boost::bind(&variable_bin::watch_loop, this, interval));
+}
+
+void variable_bin::watch_loop(boost::posix_time::time_duration interval) {
+	try {
+		for(;;) {
+			boost::this_thread::sleep(interval);
+			try {
+				reload_if_changed();
+			} catch(std::exception& e) {
+				// keep the settings we have; the file may be half written
+				std::cout << "couldn't reload settings: " << e.what() << std::endl;
+			}
+		}
+	} catch(boost::thread_interrupted&) {
+	}
+}
+
+std::string variable_bin::get_string(util::string_view key) const {
+	const std::string* found = snapshot().find_string(key);
+	return found ? *found : std::string();
+}
+
+size_t variable_bin::snapshot_count() {
+	boost::mutex::scoped_lock lock(write_mutex_);
+	return snapshots_.size();
+}
+int variable_bin::get_int(util::string_view key) const {
+	return get_int(key, 0);
+}
+// returns default_value if the key was never set
+int variable_bin::get_int(util::string_view key, int default_value) const {
+	const int* found = snapshot().find_int(key);
+	return found ? *found : default_value;
+}
+void variable_bin::put_string(util::string_view key, const std::string& value) {
+	boost::mutex::scoped_lock lock(write_mutex_);
+	if(snapshot().find_string(key))
+		return;
+	std::unique_ptr<settings_snapshot> changed = copy_current();
+	changed->strings_.insert(key, value);
+	publish(std::move(changed));
+}
+void variable_bin::put_int(util::string_view key, int value) {
+	boost::mutex::scoped_lock lock(write_mutex_);
+	if(snapshot().find_int(key))
+		return;
+	std::unique_ptr<settings_snapshot> changed = copy_current();
+	changed->ints_.insert(key, value);
+	publish(std::move(changed));
 }
-void variable_bin::put_string(std::string key, std::string value) {
-	string_map.insert(std::make_pair(key, value));
+void variable_bin::set_int(util::string_view key, int value) {
+	boost::mutex::scoped_lock lock(write_mutex_);
+	std::unique_ptr<settings_snapshot> changed = copy_current();
+	changed->ints_[key] = value;
+	publish(std::move(changed));
 }
-void variable_bin::put_int(std::string key, int value) {
-	int_map.insert(std::make_pair(key, value));
-}
\ No newline at end of file
@@ -1,53 +1,123 @@
 #pragma once
 
 #include "stdafx.h"
-#include <algorithm>
-#include <cstdlib>
+#include <ctime>
 #include <deque>
-#include <iostream>
-#include <list>
-#include <set>
-#include <map>
+#include <memory>
+#include <string>
+#include <boost/cstdint.hpp>
 #include <boost/enable_shared_from_this.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include "flat_string_map.h"
 
+class variable_bin;
+
+// The settings as they were at one moment.  A snapshot never changes once it is
+// published, so any thread can read it without locking.
+class settings_snapshot {
+public:
+	const std::string* find_string(util::string_view key) const { return strings_.find(key); }
+	const int* find_int(util::string_view key) const { return ints_.find(key); }
+
+private:
+	friend class variable_bin;
+	flat_string_map<std::string> strings_;
+	flat_string_map<int> ints_;
+};
+
+// Lets bin->Int["x"] read and write integers.  Writing publishes a new snapshot,
+// so it costs a copy of the settings; it's for tests and tools, not hot paths.
 class IntegerMap {
-public: 
-	IntegerMap(std::map<std::string,int>* map) {
-		this->map_ = map;
-	}
-	int& operator[](const std::string& _Keyval) {
-		// find element matching _Keyval or insert with default mapped
-		auto _Where = this->map_->lower_bound(_Keyval);
-		if (_Where == this->map_->end()
-			|| this->map_->comp(_Keyval, this->map_->_Key(_Where._Mynode())))
-			_Where = this->map_->insert(_Where,
-				_STD pair<std::string, int>(
-					_STD move(_Keyval),
-					int()));
-		return ((*_Where).second);
-	}
+public:
+	class entry {
+	public:
+		entry(variable_bin* bin, const std::string& key) : bin_(bin), key_(key) {}
+		entry& operator=(int value);
+		operator int() const;
+	private:
+		variable_bin* bin_;
+		std::string key_;
+	};
+
+	IntegerMap(variable_bin* bin) : bin_(bin) {}
+	entry operator[](const std::string& key) { return entry(bin_, key); }
 private:
-	std::map<std::string, int>* map_;
+	variable_bin* bin_;
 };
 
 
+// Settings read from an ini file.  Lines starting with '#' hold integers and
+// lines starting with '$' hold strings:
+//   #io_threads = 4
+//   $name = value
+// Reads never lock: they look at the current snapshot, which a writer
+// replaces whole.  What a reader is guaranteed:
+//   - get_int and get_string see one whole snapshot, never half of a reload,
+//     and a write is seen by every read that starts after it returns.
+//   - get_int allocates nothing; get_string copies the value it found.
+//   - A reference from snapshot() stays valid until kRetainedSnapshots more
+//     snapshots have been published (reloads, puts and sets each publish one)
+//     or the bin is destroyed, so don't hold one for long.  Older snapshots are
+//     freed, so memory stays bounded however long the bin is watched.
 class variable_bin
 	: public boost::enable_shared_from_this<variable_bin>
 {
-private:
-	std::map<std::string, std::string> string_map;
-	std::map<std::string, int> int_map;
-
 public:
+	// how many of the latest snapshots are kept alive, the current one included
+	static const size_t kRetainedSnapshots = 16;
+
 	IntegerMap Int;
 	variable_bin(void);
 	~variable_bin(void);
 
+	// Adds the file's settings to the current ones; a key already set keeps its value.
 	void load_from_file(std::string path);
-	void process_file_input(std::string line);
-	std::string get_string(std::string key);
-	int get_int(std::string key);
-	void put_string(std::string key, std::string value);
-	void put_int(std::string, int value);
-};
+	// Replaces the settings with the file's if the file's modified time or size
+	// changed since it was loaded.  Returns true if it did.
+	bool reload_if_changed();
+	// Starts a thread that calls reload_if_changed every interval until the bin is destroyed.
+	void watch(boost::posix_time::time_duration interval);
+
+	const settings_snapshot& snapshot() const;
+	// how many snapshots are being kept alive
+	size_t snapshot_count();
+	// the empty string if the key was never set
+	std::string get_string(util::string_view key) const;
+	// zero if the key was never set
+	int get_int(util::string_view key) const;
+	// returns default_value if the key was never set
+	int get_int(util::string_view key, int default_value) const;
+	// put_string and put_int leave a key that's already set alone
+	void put_string(util::string_view key, const std::string& value);
+	void put_int(util::string_view key, int value);
+	void set_int(util::string_view key, int value);
 
+private:
+	struct file_stamp {
+		std::time_t modified;
+		boost::uintmax_t size;
+		bool exists;
+		bool operator==(const file_stamp& other) const {
+			return exists == other.exists && modified == other.modified && size == other.size;
+		}
+	};
+
+	static file_stamp stamp_of(const std::string& path);
+	static void parse_line(util::string_view line, settings_snapshot& into);
+	static void parse_file(const std::string& path, settings_snapshot& into);
+	// a copy of the current snapshot for a writer to change; the caller holds write_mutex_
+	std::unique_ptr<settings_snapshot> copy_current() const;
+	// makes snapshot the one readers see; the caller holds write_mutex_
+	void publish(std::unique_ptr<settings_snapshot> snapshot);
+	void watch_loop(boost::posix_time::time_duration interval);
+
+	const settings_snapshot* volatile current_;
+	boost::mutex write_mutex_;
+	// the latest snapshots, oldest first; guarded by write_mutex_
+	std::deque<std::unique_ptr<const settings_snapshot> > snapshots_;
+	std::string path_;
+	file_stamp stamp_;
+	boost::thread watch_thread_;
+};
@@ -0,0 +1,21 @@
+#include "stdafx.h"
+#include <boost/bind.hpp>
+
+#include "work_pool.h"
+
+work_pool::work_pool(int threads)
+	: io_service_(),
+	work_(new boost::asio::io_service::work(io_service_))
+{
+	for (int i = 0; i < threads; ++i)
+	{
+		threads_.create_thread(
+			boost::bind(&boost::asio::io_service::run, &io_service_));
+	}
+}
+
+work_pool::~work_pool()
+{
+	work_.reset();
+	threads_.join_all();
+}
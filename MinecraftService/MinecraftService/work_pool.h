@@ -0,0 +1,89 @@
+#pragma once
+
+#include "stdafx.h"
+#include <exception>
+#include <boost/asio.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+//----------------------------------------------------------------------
+
+// A fixed set of threads for work that may block on the disk or on another
+// process, so that it never runs on the threads serving the network.
+class work_pool
+{
+public:
+	work_pool(int threads);
+
+	// Finishes the work already posted, then joins the threads.
+	~work_pool();
+
+	template <typename Handler>
+	void post(Handler handler)
+	{
+		io_service_.post(handler);
+	}
+
+	// Runs task(0) .. task(count - 1) on the pool and waits for all of them,
+	// rethrowing the first exception any of them threw.  Must not be called
+	// from one of this pool's own threads, or it can wait on itself forever.
+	template <typename Task>
+	void run_all(size_t count, Task task)
+	{
+		boost::shared_ptr<batch> tasks(new batch(count));
+		for (size_t i = 0; i < count; ++i)
+			io_service_.post(batch_task<Task>(tasks, task, i));
+
+		boost::mutex::scoped_lock lock(tasks->mutex);
+		while (tasks->remaining > 0)
+			tasks->finished.wait(lock);
+		if (tasks->error)
+			std::rethrow_exception(tasks->error);
+	}
+
+private:
+	struct batch
+	{
+		batch(size_t count) : remaining(count), error() {}
+		boost::mutex mutex;
+		boost::condition_variable finished;
+		size_t remaining;
+		std::exception_ptr error;
+	};
+
+	template <typename Task>
+	struct batch_task
+	{
+		batch_task(boost::shared_ptr<batch> tasks, Task task, size_t index)
+			: tasks_(tasks), task_(task), index_(index) {}
+
+		void operator()()
+		{
+			std::exception_ptr error;
+			try
+			{
+				task_(index_);
+			}
+			catch (...)
+			{
+				error = std::current_exception();
+			}
+			boost::mutex::scoped_lock lock(tasks_->mutex);
+			if (error && !tasks_->error)
+				tasks_->error = error;
+			if (--tasks_->remaining == 0)
+				tasks_->finished.notify_all();
+		}
+
+		boost::shared_ptr<batch> tasks_;
+		Task task_;
+		size_t index_;
+	};
+
+	boost::asio::io_service io_service_;
+	boost::scoped_ptr<boost::asio::io_service::work> work_;
+	boost::thread_group threads_;
+};
@@ -0,0 +1,401 @@
+#include "stdafx.h"
+#include <assert.h>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/filesystem.hpp>
+
+#include "worldswitch_worker.h"
+#include "../../shared/minecraft_shared.hpp"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <csignal>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#endif
+
+const std::string kServeCommand = "serve";
+const std::string kWorkerSuccess = "ok";
+
+namespace {
+
+	// Reads one whole line, however long it is, without the trailing newline.
+	bool read_line(FILE* file, std::string& line) {
+		line.clear();
+		char buffer[1024];
+		while(fgets(buffer, sizeof(buffer), file)) {
+			line += buffer;
+			if(!line.empty() && line[line.length() - 1] == '\n') {
+				line.erase(line.length() - 1);
+				if(!line.empty() && line[line.length() - 1] == '\r')
+					line.erase(line.length() - 1);
+				return true;
+			}
+		}
+		return !line.empty();
+	}
+
+	// whether the text can be sent as one field of a request line
+	bool IsPlainField(const std::string& text) {
+		return text.find_first_of(std::string(1, minecraft::kDelimiter1) + "\r\n") == std::string::npos;
+	}
+}
+
+WorldSwitchWorker::WorldSwitchWorker(std::string executable, std::string ini_file, boost::posix_time::time_duration hang_limit)
+	: executable_(executable), ini_file_(ini_file), hang_limit_(hang_limit), pending_(), next_id_(1),
+	running_(false), starts_(0), to_worker_(NULL), from_worker_(NULL), process_(0) {
+}
+
+WorldSwitchWorker::~WorldSwitchWorker() {
+	boost::mutex::scoped_lock process_lock(process_mutex_);
+	// closing the worker's stdin tells it to exit, which ends the reader thread
+	if(to_worker_) {
+		fclose(to_worker_);
+		to_worker_ = NULL;
+	}
+	if(reader_.joinable())
+		reader_.join();
+	CloseProcess();
+}
+
+WorkerResponse WorldSwitchWorker::call(std::string command, std::deque<std::string> params, boost::posix_time::ptime deadline) {
+	PendingRequest request;
+	unsigned int id;
+	// the worker splits the line on every delimiter, so a field can't hold one
+	if(!IsPlainField(command))
+		return request.response;
+	foreach(param, params) {
+		if(!IsPlainField(*param))
+			return request.response;
+	}
+	{
+		boost::mutex::scoped_lock process_lock(process_mutex_);
+		if(!EnsureRunning())
+			return request.response;
+
+		std::stringstream line;
+		{
+			boost::mutex::scoped_lock lock(mutex_);
+			// the worker may have died since EnsureRunning, and its requests already failed
+			if(!running_)
+				return request.response;
+			id = next_id_++;
+			pending_[id] = &request;
+		}
+		line << id << minecraft::kDelimiter1 << command;
+		foreach(param, params) {
+			line << minecraft::kDelimiter1 << *param;
+		}
+		line << "\n";
+
+		if(fputs(line.str().c_str(), to_worker_) < 0 || fflush(to_worker_) != 0) {
+			boost::mutex::scoped_lock lock(mutex_);
+			pending_.erase(id);
+			return WorkerResponse();
+		}
+	}
+
+	boost::posix_time::ptime hang_limit = boost::posix_time::microsec_clock::universal_time() + hang_limit_;
+	boost::mutex::scoped_lock lock(mutex_);
+	bool killed = false;
+	while(!request.done) {
+		if(killed) {
+			response_arrived_.wait(lock);
+		}
+		else if(deadline < hang_limit) {
+			if(!response_arrived_.timed_wait(lock, deadline) && !request.done) {
+				pending_.erase(id);
+				return WorkerResponse();
+			}
+		}
+		else if(!response_arrived_.timed_wait(lock, hang_limit) && !request.done) {
+			// The worker is alive but stuck.  Killing it fails this request and every
+			// other one it holds, and the next call starts a new worker.
+			std::cout << "WorldSwitch worker hung, killing it" << std::endl;
+			Kill();
+			killed = true;
+		}
+	}
+	return request.response;
+}
+
+int WorldSwitchWorker::starts() {
+	boost::mutex::scoped_lock lock(mutex_);
+	return starts_;
+}
+
+// Starts a new worker if there isn't one running.  Called with process_mutex_ held.
+bool WorldSwitchWorker::EnsureRunning() {
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		if(running_)
+			return true;
+	}
+
+	// the old reader thread has already seen the worker exit, so it is finishing up
+	if(to_worker_) {
+		fclose(to_worker_);
+		to_worker_ = NULL;
+	}
+	if(reader_.joinable())
+		reader_.join();
+	CloseProcess();
+
+	try {
+		Spawn();
+	}
+	catch (std::exception& e) {
+		std::cout << "WorldSwitch worker failed to start: " << e.what() << std::endl;
+		return false;
+	}
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		running_ = true;
+		starts_++;
+	}
+	reader_ = boost::thread(boost::bind(&WorldSwitchWorker::ReadLoop, this, from_worker_));
+	return true;
+}
+
+// Reads responses from the worker and hands each one to the request with the matching id.
+void WorldSwitchWorker::ReadLoop(FILE* from_worker) {
+	std::string line;
+	while(read_line(from_worker, line)) {
+		// id,ok|error,output: the output is everything after the second delimiter, commas and all
+		size_t status_start = line.find(minecraft::kDelimiter1);
+		if(status_start == std::string::npos)
+			continue;
+		status_start++;
+		size_t output_start = line.find(minecraft::kDelimiter1, status_start);
+		std::string status = line.substr(status_start,
+			output_start == std::string::npos ? std::string::npos : output_start - status_start);
+		unsigned int id = static_cast<unsigned int>(atoi(line.c_str()));
+
+		boost::mutex::scoped_lock lock(mutex_);
+		auto pending = pending_.find(id);
+		if(pending == pending_.end())
+			continue;
+		pending->second->response.success = status == kWorkerSuccess;
+		pending->second->response.output = output_start == std::string::npos ? "" : line.substr(output_start + 1);
+		pending->second->done = true;
+		pending_.erase(pending);
+		response_arrived_.notify_all();
+	}
+
+	std::cout << "WorldSwitch worker exited" << std::endl;
+	FailPending();
+}
+
+// The worker has gone away, so nothing outstanding will ever be answered.
+void WorldSwitchWorker::FailPending() {
+	boost::mutex::scoped_lock lock(mutex_);
+	running_ = false;
+	foreach(pending, pending_) {
+		pending->second->done = true;
+	}
+	pending_.clear();
+	response_arrived_.notify_all();
+}
+
+#ifdef _WIN32
+
+void WorldSwitchWorker::Spawn() {
+	SECURITY_ATTRIBUTES attributes;
+	attributes.nLength = sizeof(attributes);
+	attributes.bInheritHandle = TRUE;
+	attributes.lpSecurityDescriptor = NULL;
+
+	HANDLE child_stdin_read, child_stdin_write, child_stdout_read, child_stdout_write;
+	if(!CreatePipe(&child_stdin_read, &child_stdin_write, &attributes, 0))
+		throw std::runtime_error("failed to create worker pipe");
+	if(!CreatePipe(&child_stdout_read, &child_stdout_write, &attributes, 0)) {
+		CloseHandle(child_stdin_read);
+		CloseHandle(child_stdin_write);
+		throw std::runtime_error("failed to create worker pipe");
+	}
+
+	// only the child's ends should be inherited
+	SetHandleInformation(child_stdin_write, HANDLE_FLAG_INHERIT, 0);
+	SetHandleInformation(child_stdout_read, HANDLE_FLAG_INHERIT, 0);
+
+	STARTUPINFOA startup;
+	ZeroMemory(&startup, sizeof(startup));
+	startup.cb = sizeof(startup);
+	startup.dwFlags = STARTF_USESTDHANDLES;
+	startup.hStdInput = child_stdin_read;
+	startup.hStdOutput = child_stdout_write;
+	startup.hStdError = GetStdHandle(STD_ERROR_HANDLE);
+
+	PROCESS_INFORMATION info;
+	std::string command_line = executable_ + " " + ini_file_ + " " + kServeCommand;
+	std::vector<char> command_buffer(command_line.begin(), command_line.end());
+	command_buffer.push_back('\0');
+	BOOL created = CreateProcessA(NULL, &command_buffer[0], NULL, NULL, TRUE,
+		CREATE_NO_WINDOW, NULL, NULL, &startup, &info);
+
+	CloseHandle(child_stdin_read);
+	CloseHandle(child_stdout_write);
+	if(!created) {
+		CloseHandle(child_stdin_write);
+		CloseHandle(child_stdout_read);
+		throw std::runtime_error("failed to start WorldSwitch worker");
+	}
+	CloseHandle(info.hThread);
+	process_ = info.hProcess;
+
+	to_worker_ = _fdopen(_open_osfhandle(reinterpret_cast<intptr_t>(child_stdin_write), 0), "w");
+	from_worker_ = _fdopen(_open_osfhandle(reinterpret_cast<intptr_t>(child_stdout_read), _O_RDONLY), "r");
+}
+
+void WorldSwitchWorker::Kill() {
+	TerminateProcess(process_, 1);
+}
+
+void WorldSwitchWorker::CloseProcess() {
+	if(from_worker_) {
+		fclose(from_worker_);
+		from_worker_ = NULL;
+	}
+	if(process_) {
+		WaitForSingleObject(process_, INFINITE);
+		CloseHandle(process_);
+		process_ = 0;
+	}
+}
+
+#else
+
+void WorldSwitchWorker::Spawn() {
+	// a write to a worker that has died must fail rather than kill the service
+	signal(SIGPIPE, SIG_IGN);
+
+	// close-on-exec, so that later workers don't inherit this one's pipes; dup2
+	// gives the child its own ends without the flag
+	int to_child[2], from_child[2];
+	if(pipe2(to_child, O_CLOEXEC) != 0)
+		throw std::runtime_error("failed to create worker pipe");
+	if(pipe2(from_child, O_CLOEXEC) != 0) {
+		close(to_child[0]);
+		close(to_child[1]);
+		throw std::runtime_error("failed to create worker pipe");
+	}
+
+	pid_t pid = fork();
+	if(pid < 0) {
+		close(to_child[0]);
+		close(to_child[1]);
+		close(from_child[0]);
+		close(from_child[1]);
+		throw std::runtime_error("failed to start WorldSwitch worker");
+	}
+	if(pid == 0) {
+		dup2(to_child[0], STDIN_FILENO);
+		dup2(from_child[1], STDOUT_FILENO);
+		// the worker lives as long as the service, so it mustn't hold the service's
+		// sockets or anything else open; it keeps only stdin, stdout and stderr
+		long open_max = sysconf(_SC_OPEN_MAX);
+		for(int fd = STDERR_FILENO + 1; fd < (open_max > 0 ? open_max : 1024); fd++)
+			close(fd);
+		execlp(executable_.c_str(), executable_.c_str(), ini_file_.c_str(), kServeCommand.c_str(), (char*)NULL);
+		_exit(127);
+	}
+
+	close(to_child[0]);
+	close(from_child[1]);
+	process_ = pid;
+	to_worker_ = fdopen(to_child[1], "w");
+	from_worker_ = fdopen(from_child[0], "r");
+}
+
+void WorldSwitchWorker::Kill() {
+	kill(process_, SIGKILL);
+}
+
+void WorldSwitchWorker::CloseProcess() {
+	if(from_worker_) {
+		fclose(from_worker_);
+		from_worker_ = NULL;
+	}
+	if(process_) {
+		waitpid(process_, NULL, 0);
+		process_ = 0;
+	}
+}
+
+#endif
+
+void test_worldswitch_worker() {
+	std::cout << "testing WorldSwitch worker..." << std::endl;
+	// a stand-in worker that reads requests and never answers them
+#ifdef _WIN32
+	const std::string stand_in = "worker_stand_in.cmd";
+	{
+		std::ofstream script(stand_in.c_str());
+		script << "@echo off\n:loop\nset /p line= || exit /b\ngoto loop\n";
+	}
+#else
+	const std::string stand_in = "./worker_stand_in.sh";
+	{
+		std::ofstream script(stand_in.c_str());
+		script << "#!/bin/sh\nwhile read line; do :; done\n";
+	}
+	chmod(stand_in.c_str(), 0755);
+#endif
+	std::deque<std::string> params;
+	params.push_back("player");
+	params.push_back("world");
+	{
+		WorldSwitchWorker worker(stand_in, "worldswitch.ini", boost::posix_time::milliseconds(200));
+
+		// a deadline before the hang limit fails the request but leaves the worker alone
+		auto deadline = boost::posix_time::microsec_clock::universal_time() + boost::posix_time::milliseconds(50);
+		assert(!worker.call(commands::teleport, params, deadline).success);
+		assert(worker.starts() == 1);
+
+		// with no deadline, the hang limit kills the worker and the next call starts another
+		assert(!worker.call(commands::teleport, params).success);
+		assert(!worker.call(commands::teleport, params).success);
+		assert(worker.starts() == 2);
+	}
+	boost::filesystem::remove(stand_in);
+	std::cout << "finished testing WorldSwitch worker" << std::endl;
+}
+
+void benchmark_worldswitch_worker(std::string executable, std::string ini_file, int count) {
+	using boost::posix_time::microsec_clock;
+	std::cout << "benchmarking WorldSwitch worker..." << std::endl;
+
+	std::stringstream one_shot;
+	one_shot << executable << " " << ini_file << " " << commands::get_coords << " player world";
+	auto start = microsec_clock::universal_time();
+	for(int i = 0; i < count; i++) {
+		FILE* output = _popen(one_shot.str().c_str(), "r");
+		std::string line;
+		read_line(output, line);
+		_pclose(output);
+	}
+	double spawn_seconds = (microsec_clock::universal_time() - start).total_microseconds() / 1e6;
+
+	WorldSwitchWorker worker(executable, ini_file);
+	std::deque<std::string> params;
+	params.push_back("player");
+	params.push_back("world");
+	worker.call(commands::get_coords, params); // start the worker outside the timing
+	start = microsec_clock::universal_time();
+	for(int i = 0; i < count; i++)
+		worker.call(commands::get_coords, params);
+	double worker_seconds = (microsec_clock::universal_time() - start).total_microseconds() / 1e6;
+
+	std::cout << "process per command: " << count / spawn_seconds << " requests/sec" << std::endl;
+	std::cout << "persistent worker:   " << count / worker_seconds << " requests/sec" << std::endl;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "stdafx.h"
+#include <cstdio>
+#include <deque>
+#include <map>
+#include <string>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+// The answer to one request sent to the worker.
+struct WorkerResponse {
+	bool success;
+	std::string output;
+
+	WorkerResponse() : success(false), output() {}
+};
+
+// WorldSwitchWorker keeps a single WorldSwitch.exe running in "serve" mode and talks to it
+// over its stdin and stdout, instead of starting a new process for every command.
+//
+// Requests are written as one line each:   id,command,param1,param2...
+// and the worker answers with one line:    id,ok|error,output
+// A request whose command or params hold a ',' or a line break fails without being
+// sent, since the worker couldn't split it back up.  The output may hold commas.
+// The id is a correlation id, so several threads can have requests outstanding at once
+// and each gets back its own answer.
+//
+// how long a call waits for its answer, whatever its deadline, before the worker is
+// taken to be hung and killed
+const boost::posix_time::time_duration kWorkerHangLimit = boost::posix_time::minutes(3);
+
+// If the worker exits, every outstanding request fails and the next request starts a new worker.
+// A worker that is still running but hasn't answered within hang_limit is killed, so that
+// a stuck worker can't hold the threads waiting on it for good.
+class WorldSwitchWorker {
+public:
+	WorldSwitchWorker(std::string executable, std::string ini_file,
+		boost::posix_time::time_duration hang_limit = kWorkerHangLimit);
+	~WorldSwitchWorker();
+
+	// Sends the command to the worker and blocks until its response arrives.
+	// If the deadline (in UTC) passes first, the request fails; the worker still finishes it.
+	// If the hang limit passes first, the worker is killed and the request fails.
+	WorkerResponse call(std::string command, std::deque<std::string> params,
+		boost::posix_time::ptime deadline = boost::posix_time::ptime(boost::posix_time::pos_infin));
+
+	// number of times the worker process has been started
+	int starts();
+
+private:
+	struct PendingRequest {
+		bool done;
+		WorkerResponse response;
+		PendingRequest() : done(false), response() {}
+	};
+
+	bool EnsureRunning();
+	void Spawn();
+	void CloseProcess();
+	// Kills the running worker.  Called with mutex_ held while running_ is set, so
+	// the process hasn't been waited for and closed yet.
+	void Kill();
+	void ReadLoop(FILE* from_worker);
+	void FailPending();
+
+	std::string executable_;
+	std::string ini_file_;
+	boost::posix_time::time_duration hang_limit_;
+
+	// guards the request bookkeeping; callers wait on response_arrived_ for their answer
+	boost::mutex mutex_;
+	boost::condition_variable response_arrived_;
+	std::map<unsigned int, PendingRequest*> pending_;
+	unsigned int next_id_;
+	bool running_;
+	int starts_;
+
+	// held while writing to the worker, or while replacing the worker process
+	boost::mutex process_mutex_;
+	boost::thread reader_;
+	FILE* to_worker_;
+	FILE* from_worker_;
+#ifdef _WIN32
+	void* process_;
+#else
+	int process_;
+#endif
+};
+
+void test_worldswitch_worker();
+
+// Compares starting WorldSwitch.exe for every command against one persistent worker.
+void benchmark_worldswitch_worker(std::string executable, std::string ini_file, int count);
@@ -25,6 +25,12 @@ namespace WorldSwitch
                 return;
             }
 
+            if (args[1] == "serve")
+            {
+                Serve(args[0]);
+                return;
+            }
+
             var controller = new Controller(args);
             bool success = controller.PerformCommand();
             if (!success)
@@ -32,6 +38,47 @@ namespace WorldSwitch
                 Usage();
             }
         }
+
+        // Runs as a long-lived worker for MinecraftService.
+        // Each request is one line on stdin:   id,command,param1,param2...
+        // and each gets one line back on stdout: id,ok|error,output
+        // where output is the first line the command printed.
+        static void Serve(string inifile)
+        {
+            var stdout = Console.Out;
+            string line;
+            while ((line = Console.In.ReadLine()) != null)
+            {
+                var fields = line.Split(',');
+                if (fields.Length < 2)
+                    continue;
+
+                string id = fields[0];
+                var args = new string[fields.Length];
+                args[0] = inifile;
+                Array.Copy(fields, 1, args, 1, fields.Length - 1);
+
+                var output = new StringWriter();
+                bool success = false;
+                Console.SetOut(output);
+                try
+                {
+                    success = new Controller(args).PerformCommand();
+                }
+                catch (Exception e)
+                {
+                    File.WriteAllText("WorldSwitch.exe.log", e.ToString());
+                }
+                finally
+                {
+                    Console.SetOut(stdout);
+                }
+
+                var lines = output.ToString().Split(new[] { Environment.NewLine }, StringSplitOptions.None);
+                stdout.WriteLine("{0},{1},{2}", id, success ? "ok" : "error", lines[0]);
+                stdout.Flush();
+            }
+        }
     }
 
     class Controller
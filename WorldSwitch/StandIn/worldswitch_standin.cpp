@@ -0,0 +1,57 @@
+// worldswitch_standin.cpp
+//
+// A stand-in for WorldSwitch.exe that speaks the same command line and "serve"
+// protocol but never touches a world.  It lets the service's WorldSwitch worker
+// be exercised and benchmarked on machines without .NET or a Minecraft server:
+//
+//   g++ -O2 -o WorldSwitch.exe worldswitch_standin.cpp
+//
+// One-shot:  WorldSwitch.exe <inifile> <command> params...
+// Worker:    WorldSwitch.exe <inifile> serve
+//            reads   id,command,params...   and answers   id,ok|error,output
+
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// the first line WorldSwitch.exe prints for the command
+std::string perform(const std::string& command) {
+	if(command == "get_coords")
+		return "0:64:0";
+	if(command == "worldswitch" || command == "teleport")
+		return "success,";
+	return "";
+}
+
+void serve() {
+	std::string line;
+	while(std::getline(std::cin, line)) {
+		std::string::size_type id_end = line.find(',');
+		if(id_end == std::string::npos)
+			continue;
+		std::string id = line.substr(0, id_end);
+		std::string command = line.substr(id_end + 1, line.find(',', id_end + 1) - id_end - 1);
+		std::string output = perform(command);
+		std::cout << id << "," << (output.empty() ? "error" : "ok") << "," << output << std::endl;
+	}
+}
+
+int main(int argc, char* argv[]) {
+	if(argc < 3) {
+		std::cerr << "usage: WorldSwitch.exe <inifile> <command> params..." << std::endl;
+		return 1;
+	}
+	std::string command = argv[2];
+	if(command == "serve") {
+		serve();
+		return 0;
+	}
+	std::string output = perform(command);
+	if(output.empty())
+		return 1;
+	std::cout << output << std::endl;
+	if(command == "get_coords")
+		std::cout << "success," << std::endl;
+	return 0;
+}
@@ -4,6 +4,7 @@
 #include <cstdlib>
 #include <vector>
 #include <deque>
+#include "string_view.hpp"
 
 namespace minecraft  {
 	const char kDelimiter1 = ',';
@@ -13,79 +14,63 @@ namespace minecraft  {
 
 namespace util  {
 	
-	// Converts: 
+	// Copies each field util::splitter finds into a string:
 	// "a,b,c"   --> ["a", "b", "c"]
 	// "a,b,c,"  --> ["a", "b", "c"]
 	// "a,,b,c," --> ["a", "", "b", "c"]
-	// ","       --> []
+	// ","       --> [""]
 	// ""        --> []
-	std::vector<std::string> tokenize(std::string text, char delimiter) {
-		
+	inline std::vector<std::string> tokenize(const std::string& text, char delimiter) {
 		std::vector<std::string> split;
-
-		int index = text.find_first_of(delimiter);
-		while(std::string::npos != index) {
-			split.push_back(text.substr(0, index));
-			text = text.substr(index + 1, text.length() - index - 1);
-			index = text.find_first_of(delimiter);
-		}
-
-		if(text.length() > 0)
-			split.push_back(text);
-		
+		splitter fields(text, delimiter);
+		string_view field;
+		while(fields.next(field))
+			split.push_back(field.str());
 		return split;
 	}
 }
 
+// Every command that can be passed between the client and server, in the order
+// of their binary wire ids (see wire_protocol.hpp).  The ids are part of the
+// protocol, so only ever add to the end.
+// Generally, "response" commands are sent from server to client.
+#define MINECRAFT_COMMANDS( COMMAND ) \
+	COMMAND(quit) \
+	COMMAND(login) \
+	COMMAND(menu) /* back to main menu */ \
+	COMMAND(menu_response) \
+	COMMAND(say) \
+	COMMAND(teleport) \
+	COMMAND(teleport_response) \
+	COMMAND(worldswitch) \
+	COMMAND(worldswitch_response) \
+	COMMAND(get_teleports) \
+	COMMAND(get_teleports_response) \
+	COMMAND(get_worldswitches) \
+	COMMAND(get_worldswitches_response) \
+	COMMAND(get_coords) \
+	/* both of the main menu's lists at once: the packed teleports, then the packed world switches */ \
+	COMMAND(get_menu_state) \
+	COMMAND(get_menu_state_response)
+
 namespace commands {
 
-// I can remove this macro use when I'm done defining new commands.
-// Each entry defines a command that can be passed between the client and server.
-// Generally, "response" commands are sent from server to client.
-#define COMMAND( x, n ) \
-	const std::string x = #x
-
-	COMMAND(quit);
-	COMMAND(login);
-	COMMAND(menu); // back to main menu
-	COMMAND(menu_response);
-	COMMAND(say);
-	COMMAND(teleport);
-	COMMAND(teleport_response);
-
-	COMMAND(worldswitch);
-	COMMAND(worldswitch_response);
-	COMMAND(get_teleports);
-	COMMAND(get_teleports_response);
-	COMMAND(get_worldswitches);
-	COMMAND(get_worldswitches_response);
-
-	COMMAND(get_coords);
+#define COMMAND( x ) \
+	const std::string x = #x;
+
+	MINECRAFT_COMMANDS(COMMAND)
 #undef COMMAND
 
 }
 
 
-// Converts: 
-// "a,b,c"   --> ["a", "b", "c"]
-// "a,b,c,"  --> ["a", "b", "c"]
-// "a,,b,c," --> ["a", "", "b", "c"]
-// ","       --> []
-// ""        --> []
-std::deque<std::string> tokenize(std::string text, char delimiter) {
-	
+// Same as util::tokenize, into a deque.
+inline std::deque<std::string> tokenize(const std::string& text, char delimiter) {
 	std::deque<std::string> split;
-
-	int index = text.find_first_of(delimiter);
-	while(std::string::npos != index) {
-		split.push_back(text.substr(0, index));
-		text = text.substr(index + 1, text.length() - index - 1);
-		index = text.find_first_of(delimiter);
-	}
-
-	if(text.length() > 0)
-		split.push_back(text);
-	
+	util::splitter fields(text, delimiter);
+	util::string_view field;
+	while(fields.next(field))
+		split.push_back(field.str());
 	return split;
 }
 
@@ -94,16 +79,27 @@ std::deque<std::string> tokenize(std::string text, char delimiter) {
 // Messages consist of a command, username, and variable number of parameters.
 // All of these fields are stored as a comma-delimited string when passed to 
 // the client and server classes in the code.
+//
+// A request may also carry a request id, which the server copies onto its
+// reply so that a client with several requests outstanding can tell which
+// reply is which.  0 means the request has none.
 class MinecraftMessage {
 
 	static const char delimiter = minecraft::kDelimiter1;
 
 public:
-	MinecraftMessage(std::string command, const std::string& user, std::string params) : command_(command), user_(user) {
-		auto tokens = tokenize(params, delimiter);		
-		params_ = std::deque<std::string>(tokens);
+	// an empty message, which is never sent
+	MinecraftMessage() : request_id_(0) {}
+	MinecraftMessage(std::string command, const std::string& user, std::deque<std::string> params)
+		: params_(params), command_(command), user_(user), request_id_(0) {
+	}
+	MinecraftMessage(std::string command, const std::string& user, std::string params) : command_(command), user_(user), request_id_(0) {
+		util::splitter fields(params, delimiter);
+		util::string_view field;
+		while(fields.next(field))
+			params_.push_back(field.str());
 	}
-	MinecraftMessage(std::deque<std::string> tokens) {
+	MinecraftMessage(std::deque<std::string> tokens) : request_id_(0) {
 		command_ = tokens.front();
 		tokens.pop_front();
 		user_ = tokens.front();
@@ -112,32 +108,43 @@ public:
 		params_ = std::deque<std::string>(tokens);
 	}
 
-	MinecraftMessage(std::string message) {
-		auto tokens = tokenize(message, delimiter);		
-		command_ = tokens.front();
-		tokens.pop_front();
-		user_ = tokens.front();
-		tokens.pop_front();
-
-		params_ = std::deque<std::string>(tokens);
+	MinecraftMessage(std::string message) : request_id_(0) {
+		util::splitter fields(message, delimiter);
+		util::string_view field;
+		if(fields.next(field))
+			command_ = field.str();
+		if(fields.next(field))
+			user_ = field.str();
+		while(fields.next(field))
+			params_.push_back(field.str());
 	}
 
 	std::string const& command() const { return command_; }
 	std::string const& user() const { return user_; }
+	std::deque<std::string> const& params() const { return params_; }
+	unsigned int request_id() const { return request_id_; }
+
+	void set_request_id(unsigned int request_id) {
+		request_id_ = request_id;
+	}
+
+	bool empty() const {
+		return command_.empty();
+	}
 
-	int num_params() {
+	int num_params() const {
 		return params_.size();
 	}
 
 	// returns the nth parameter, indexed from 0.  
 	// So if the message is "teleport,PhilipM,200,300"
 	// then msg[0] == 200 and msg[1] == 300
-	std::string operator[](int place) {
+	std::string operator[](int place) const {
 		return params_.at(place); 
 	}
 
-	// formats the message as a comma delimited string as it will be sent over the network
-	std::string AsMessage() {
+	// formats the message as a comma delimited string, as the ascii wire format sends it
+	std::string AsMessage() const {
 		std::stringstream stream;
 		stream << command_ << delimiter << user_;
 		foreach(str, params_) {
@@ -150,6 +157,7 @@ private:
 	std::deque<std::string> params_;
 	std::string command_;
 	std::string user_;
+	unsigned int request_id_;
 };
 
 // represents a point in three-dimensional space of the minecraft world
@@ -170,19 +178,20 @@ struct Coordinates {
 		z = atof(z_.c_str());
 	}
 	Coordinates(std::string str) {
-		auto list = util::tokenize(str, delimiter);
-		x = atof(list[0].c_str());
-		y = atof(list[1].c_str());
-		z = atof(list[2].c_str());
+		util::splitter fields(str, delimiter);
+		util::string_view field;
+		x = fields.next(field) ? util::to_double(field) : 0;
+		y = fields.next(field) ? util::to_double(field) : 0;
+		z = fields.next(field) ? util::to_double(field) : 0;
 	}
 
-	std::string ToString() {
+	std::string ToString() const {
 		std::stringstream stream;
 		stream << x << delimiter << y << delimiter << z;
 		return stream.str();
 	}
 
-	bool Within(Coordinates other, double distance) {
+	bool Within(const Coordinates& other, double distance) const {
 		return (abs(other.x - x) < distance)
 			&& (abs(other.y - y) < distance)
 			&& (abs(other.z - z) < distance);
@@ -219,15 +228,17 @@ struct TeleportPair {
 	}
 
 	TeleportPair(std::string packed) {
-		auto unpacked = util::tokenize(packed, delimiter);
-		World = unpacked[0];
-		auto location1 = unpacked[1];
-		auto location2 = unpacked[2];
-		Teleport1 = Teleport(World, location1, Coordinates());
-		Teleport2 = Teleport(World, location2, Coordinates());
+		util::splitter fields(packed, delimiter);
+		util::string_view world, location1, location2;
+		fields.next(world);
+		fields.next(location1);
+		fields.next(location2);
+		World = world.str();
+		Teleport1 = Teleport(World, location1.str(), Coordinates());
+		Teleport2 = Teleport(World, location2.str(), Coordinates());
 	}
 
-	std::string ToString() {
+	std::string ToString() const {
 		std::stringstream stream;
 		stream << World << delimiter << Teleport1.Location << delimiter << Teleport2.Location;
 		return stream.str();
@@ -251,12 +262,15 @@ struct WorldSwitch {
 	}
 
 	WorldSwitch(std::string packed) {
-		auto unpacked = util::tokenize(packed, delimiter);
-		World1 = unpacked[0];
-		World2 = unpacked[1];
+		util::splitter fields(packed, delimiter);
+		util::string_view world1, world2;
+		fields.next(world1);
+		fields.next(world2);
+		World1 = world1.str();
+		World2 = world2.str();
 	}
 
-	std::string ToString() {
+	std::string ToString() const {
 		std::stringstream stream;
 		stream << World1 << delimiter << World2;
 		return stream.str();
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace util  {
+
+	// A pointer and a length into characters owned by someone else, like C++17's
+	// std::string_view, which this compiler doesn't have.
+	// The characters must outlive the view.
+	class string_view {
+	public:
+		static const size_t npos = static_cast<size_t>(-1);
+
+		string_view() : data_(NULL), size_(0) {}
+		string_view(const char* data, size_t size) : data_(data), size_(size) {}
+		string_view(const char* text) : data_(text), size_(std::strlen(text)) {}
+		string_view(const std::string& text) : data_(text.data()), size_(text.size()) {}
+
+		const char* data() const { return data_; }
+		size_t size() const { return size_; }
+		size_t length() const { return size_; }
+		bool empty() const { return size_ == 0; }
+		const char* begin() const { return data_; }
+		const char* end() const { return data_ + size_; }
+		char operator[](size_t place) const { return data_[place]; }
+
+		string_view substr(size_t pos, size_t count = npos) const {
+			pos = (std::min)(pos, size_);
+			return string_view(data_ + pos, (std::min)(count, size_ - pos));
+		}
+
+		size_t find(char c, size_t pos = 0) const {
+			if(pos >= size_)
+				return npos;
+			const void* found = std::memchr(data_ + pos, c, size_ - pos);
+			return found ? static_cast<const char*>(found) - data_ : npos;
+		}
+
+		std::string str() const { return size_ ? std::string(data_, size_) : std::string(); }
+
+		bool operator==(const string_view& other) const {
+			return size_ == other.size_ && (size_ == 0 || std::memcmp(data_, other.data_, size_) == 0);
+		}
+		bool operator!=(const string_view& other) const { return !(*this == other); }
+		bool operator<(const string_view& other) const {
+			size_t common = (std::min)(size_, other.size_);
+			int order = common ? std::memcmp(data_, other.data_, common) : 0;
+			return order < 0 || (order == 0 && size_ < other.size_);
+		}
+
+	private:
+		const char* data_;
+		size_t size_;
+	};
+
+	// Reads a number the way atof does, without copying the view to the heap.
+	inline double to_double(string_view text) {
+		char buffer[64];
+		size_t length = (std::min)(text.size(), sizeof(buffer) - 1);
+		std::memcpy(buffer, text.data(), length);
+		buffer[length] = '\0';
+		return atof(buffer);
+	}
+
+	// Walks the fields of a delimited string without copying or allocating:
+	// "a,b,c"   --> ["a", "b", "c"]
+	// "a,b,c,"  --> ["a", "b", "c"]
+	// "a,,b,c," --> ["a", "", "b", "c"]
+	// ","       --> [""]
+	// ""        --> []
+	class splitter {
+	public:
+		splitter(string_view text, char delimiter) : rest_(text), delimiter_(delimiter), done_(false) {}
+
+		// Sets field to the next field and returns true, or returns false when there are no more.
+		bool next(string_view& field) {
+			if(done_)
+				return false;
+			size_t index = rest_.find(delimiter_);
+			if(index == string_view::npos) {
+				done_ = true;
+				field = rest_;
+				return !rest_.empty();
+			}
+			field = rest_.substr(0, index);
+			rest_ = rest_.substr(index + 1);
+			return true;
+		}
+
+	private:
+		string_view rest_;
+		char delimiter_;
+		bool done_;
+	};
+
+	// Replaces fields with the fields of text.  Reusing the same vector means
+	// nothing is allocated once it has grown to the longest line.
+	inline void split(string_view text, char delimiter, std::vector<string_view>& fields) {
+		fields.clear();
+		splitter fields_of(text, delimiter);
+		string_view field;
+		while(fields_of.next(field))
+			fields.push_back(field);
+	}
+}
@@ -0,0 +1,293 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <string>
+#include "chat_message.hpp"
+#include "minecraft_shared.hpp"
+
+// The two ways a MinecraftMessage can be framed on the wire.
+//
+// ascii (version 1), the original format:
+//   a 4 character "%4d" body length, then the body "command,user,param1,param2..."
+//   a request id, if any, follows the command as "command#id"
+//
+// binary (version 2):
+//   kBinaryMarker, a varint body length, then the body:
+//     varint command id                 (0 means the name follows as a string)
+//     [string command name]
+//     string user
+//     one typed field per parameter:    a FieldType byte, then its payload
+//     [kFieldRequestId, varint id]
+//   strings are a varint length and the bytes, so parameters may hold any characters.
+//
+// Each frame says which format it is in, since no ascii header can start with
+// kBinaryMarker.  A session answers in the format its client logged in with, so
+// clients that only know ascii never see a binary frame.
+namespace wire {
+
+	enum Format {
+		kAscii = 1,
+		kBinary = 2
+	};
+
+	const unsigned char kBinaryMarker = 0xB2;
+	const size_t kMaxBinaryBody = 65535;
+	// the longest varint that can hold kMaxBinaryBody
+	const size_t kMaxLengthVarint = 3;
+	// a marker, the body length and the body
+	const size_t kMaxFrameLength = 1 + kMaxLengthVarint + kMaxBinaryBody;
+
+	enum FieldType {
+		kFieldString = 1,
+		kFieldRequestId = 2
+	};
+
+	const char kRequestIdMarker = '#';
+
+	// Index is the command id, from the order of MINECRAFT_COMMANDS; 0 is no command.
+#define COMMAND_NAME( x ) #x,
+	const char* const kCommandNames[] = {
+		"",
+		MINECRAFT_COMMANDS(COMMAND_NAME)
+	};
+#undef COMMAND_NAME
+	const unsigned int kCommandCount = sizeof(kCommandNames) / sizeof(kCommandNames[0]);
+
+	inline unsigned int command_id(const std::string& command) {
+		for(unsigned int id = 1; id < kCommandCount; id++) {
+			if(command == kCommandNames[id])
+				return id;
+		}
+		return 0;
+	}
+
+	inline void put_varint(std::string& out, unsigned long long value) {
+		while(value >= 0x80) {
+			out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+			value >>= 7;
+		}
+		out.push_back(static_cast<char>(value));
+	}
+
+	enum ParseResult {
+		kIncomplete,
+		kComplete,
+		kInvalid
+	};
+
+	// Reads a varint at next, moving next past it.  Only the shortest encoding of
+	// a value is accepted, so no varint is longer than put_varint writes, and one
+	// longer than max_length bytes is invalid.
+	inline ParseResult get_varint(const char*& next, const char* end, unsigned long long& value,
+		size_t max_length = 10) {
+		value = 0;
+		for(size_t length = 0; length < max_length; length++) {
+			if(next == end)
+				return kIncomplete;
+			unsigned char byte = static_cast<unsigned char>(*next++);
+			value |= static_cast<unsigned long long>(byte & 0x7f) << (7 * length);
+			if(!(byte & 0x80))
+				return byte == 0 && length > 0 ? kInvalid : kComplete;
+		}
+		return kInvalid;
+	}
+
+	inline size_t varint_length(unsigned long long value) {
+		size_t length = 1;
+		while(value >= 0x80) {
+			value >>= 7;
+			length++;
+		}
+		return length;
+	}
+
+	inline void put_string(std::string& out, const std::string& text) {
+		put_varint(out, text.length());
+		out.append(text);
+	}
+
+	inline size_t string_length(const std::string& text) {
+		return varint_length(text.length()) + text.length();
+	}
+
+	// Reads a string that must lie wholly before end.
+	inline bool get_string(const char*& next, const char* end, std::string& text) {
+		unsigned long long length;
+		if(get_varint(next, end, length) != kComplete || length > static_cast<unsigned long long>(end - next))
+			return false;
+		text.assign(next, static_cast<size_t>(length));
+		next += length;
+		return true;
+	}
+
+	// Appends the message to out, framed in the given format.  The lengths are
+	// worked out first, so the frame is written straight into out in one pass.
+	// An ascii body is cut off at chat_message::max_body_length, as it always has been.
+	// A binary body may be up to kMaxBinaryBody long, and keeps only the parameters that fit.
+	inline void encode(const MinecraftMessage& message, Format format, std::string& out) {
+		if(format == kAscii) {
+			char tag[16] = "";
+			if(message.request_id() != 0)
+				sprintf(tag, "%c%u", kRequestIdMarker, message.request_id());
+			size_t tag_length = strlen(tag);
+			size_t body_length = message.command().length() + tag_length + 1 + message.user().length();
+			foreach(param, message.params()) {
+				body_length += 1 + param->length();
+			}
+			if(body_length > chat_message::max_body_length)
+				body_length = chat_message::max_body_length;
+
+			char header[chat_message::header_length + 1];
+			sprintf(header, "%4d", static_cast<int>(body_length));
+			out.reserve(out.length() + chat_message::header_length + body_length);
+			out.append(header, chat_message::header_length);
+			size_t body_start = out.length();
+			out.append(message.command());
+			out.append(tag, tag_length);
+			out.push_back(minecraft::kDelimiter1);
+			out.append(message.user());
+			foreach(param, message.params()) {
+				if(out.length() - body_start >= body_length)
+					break;
+				out.push_back(minecraft::kDelimiter1);
+				out.append(*param);
+			}
+			out.resize(body_start + body_length);
+			return;
+		}
+
+		unsigned int id = command_id(message.command());
+		size_t header_length = varint_length(id) + (id == 0 ? string_length(message.command()) : 0)
+			+ string_length(message.user());
+		if(message.request_id() != 0)
+			header_length += 1 + varint_length(message.request_id());
+		// a body cut off part way through a field couldn't be read at all, so a
+		// message too long to send keeps only the parameters that fit whole, the
+		// way the ascii format cuts off the end
+		size_t body_length = header_length;
+		size_t param_count = 0;
+		foreach(param, message.params()) {
+			size_t param_length = 1 + string_length(*param);
+			if(body_length + param_length > kMaxBinaryBody)
+				break;
+			body_length += param_length;
+			param_count++;
+		}
+
+		out.reserve(out.length() + 1 + varint_length(body_length) + body_length);
+		out.push_back(static_cast<char>(kBinaryMarker));
+		put_varint(out, body_length);
+		put_varint(out, id);
+		if(id == 0)
+			put_string(out, message.command());
+		put_string(out, message.user());
+		for(size_t param = 0; param < param_count; param++) {
+			out.push_back(static_cast<char>(kFieldString));
+			put_string(out, message.params()[param]);
+		}
+		if(message.request_id() != 0) {
+			out.push_back(static_cast<char>(kFieldRequestId));
+			put_varint(out, message.request_id());
+		}
+	}
+
+	inline bool decode_binary_body(const char* next, const char* end, MinecraftMessage& message) {
+		unsigned long long id;
+		std::string command, user;
+		if(get_varint(next, end, id) != kComplete || id >= kCommandCount)
+			return false;
+		if(id == 0) {
+			if(!get_string(next, end, command))
+				return false;
+		}
+		else {
+			command = kCommandNames[id];
+		}
+		if(!get_string(next, end, user))
+			return false;
+
+		std::deque<std::string> params;
+		unsigned long long request_id = 0;
+		while(next != end) {
+			switch(static_cast<unsigned char>(*next++)) {
+			case kFieldString:
+				params.push_back(std::string());
+				if(!get_string(next, end, params.back()))
+					return false;
+				break;
+			case kFieldRequestId:
+				if(get_varint(next, end, request_id) != kComplete || request_id > 0xffffffffULL)
+					return false;
+				break;
+			default:
+				return false;
+			}
+		}
+		message = MinecraftMessage(command, user, params);
+		message.set_request_id(static_cast<unsigned int>(request_id));
+		return true;
+	}
+
+	// Moves a "#id" on the end of an ascii command into the message's request id.
+	// A command with anything but digits after the marker is left as it is, as is
+	// one tagged "#0", since 0 means a message has no id.
+	inline void take_request_id(MinecraftMessage& message) {
+		const std::string& command = message.command();
+		size_t marker = command.rfind(kRequestIdMarker);
+		if(marker == std::string::npos || marker + 1 == command.length() || command.length() - marker > 11)
+			return;
+		unsigned long long request_id = 0;
+		for(size_t i = marker + 1; i < command.length(); i++) {
+			if(command[i] < '0' || command[i] > '9')
+				return;
+			request_id = request_id * 10 + (command[i] - '0');
+		}
+		if(request_id == 0 || request_id > 0xffffffffULL)
+			return;
+		message = MinecraftMessage(command.substr(0, marker), message.user(), message.params());
+		message.set_request_id(static_cast<unsigned int>(request_id));
+	}
+
+	// Looks for one whole frame at the start of data.  When it finds one it fills in
+	// message, the format it came in and how many bytes it took up.  kInvalid means the
+	// bytes can never become a frame, so the connection should be dropped.
+	inline ParseResult parse(const char* data, size_t length,
+		MinecraftMessage& message, Format& format, size_t& frame_length) {
+		if(length == 0)
+			return kIncomplete;
+
+		if(static_cast<unsigned char>(data[0]) == kBinaryMarker) {
+			const char* next = data + 1;
+			const char* end = data + length;
+			unsigned long long body_length;
+			ParseResult header = get_varint(next, end, body_length, kMaxLengthVarint);
+			if(header != kComplete)
+				return header;
+			if(body_length > kMaxBinaryBody)
+				return kInvalid;
+			if(static_cast<unsigned long long>(end - next) < body_length)
+				return kIncomplete;
+			format = kBinary;
+			frame_length = (next - data) + static_cast<size_t>(body_length);
+			return decode_binary_body(next, next + body_length, message) ? kComplete : kInvalid;
+		}
+
+		if(length < chat_message::header_length)
+			return kIncomplete;
+		char header[chat_message::header_length + 1] = "";
+		strncat(header, data, chat_message::header_length);
+		int body_length = atoi(header);
+		if(body_length < 0 || body_length > chat_message::max_body_length)
+			return kInvalid;
+		if(length < chat_message::header_length + body_length)
+			return kIncomplete;
+		format = kAscii;
+		frame_length = chat_message::header_length + body_length;
+		message = MinecraftMessage(std::string(data + chat_message::header_length, body_length));
+		take_request_id(message);
+		return kComplete;
+	}
+}